@@ -1,82 +1,633 @@
-//arm-linux-gcc ADXL345.c -o ADXL345
-// Distributed with a free-will license.
-// Use it any way you want, profit or free, provided it fits in the licenses of its associated works.
-// ADXL345
-// This code is designed to work with the ADXL345_I2CS I2C Mini Module available from ControlEverything.com.
-// https://www.controleverything.com/content/Accelorometer?sku=ADXL345_I2CS#tabs-0-product_tabset-2
+//arm-linux-gcc -O2 ADXL345.c -o ADXL345 -lpthread
+// ADXL345 logger : records timestamped X/Y/Z samples into a binary log file.
+//
+//   ./ADXL345 -o run.bin -r 800 -d 3600          adxl345.ko, /dev/adxl345_ring<N> (default)
+//   ./ADXL345 -s stream -o run.bin -r 800        adxl345.ko, /dev/adxl345_stream<N>
+//   ./ADXL345 -s i2c -b /dev/i2c-2 -o run.bin    no driver, FIFO drained over i2c-dev
+//
+// The log is a struct adxl345_log_hdr followed by struct adxl345_sample
+// records (adxl345_ring.h). Samples are collected into one of two page
+// aligned buffers while a writer thread flushes the other one with a single
+// large write(), so a slow SD card only stalls the writer, never the reads;
+// the driver (or the sensor FIFO in i2c mode) absorbs the difference.
+// Every -i seconds and at the end the achieved rate, timestamp gaps and
+// driver side drops are reported.
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <linux/i2c-dev.h>
-#include <sys/ioctl.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <getopt.h>
+#include <glob.h>
+#include <poll.h>
+#include <pthread.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#include "adxl345_ring.h"
+
+// N from the sensor's stream_index attribute, see driver_setup()
+static char ring_dev[32] = "/dev/adxl345_ring0";
+static char stream_dev[32] = "/dev/adxl345_stream0";
+#define ADXL345_ADDR	0x53
+#define FULL_RES_NANO	38246000	// 3.9 mg/LSB in m/s^2 * 1e9
+
+static const char *out_path = "adxl345.bin";
+static const char *source = "ring";
+static const char *bus = "/dev/i2c-2";
+static double rate = 100;
+static unsigned int dec = 1;		// driver filter_decimation, output = rate / dec
+static double duration;			// s, 0 = until Ctrl-C
+static double report_every = 10;	// s
+static size_t buf_size = 1 << 20;	// per buffer
+
+static volatile sig_atomic_t stop;
+
+// ---------------------------------------------------------------- output
+
+struct logbuf {
+	char *data;
+	size_t len;
+	int full;
+};
+
+static struct logbuf bufs[2];
+static int cur;
+static int out_fd;
+static int finish;
+static pthread_mutex_t buf_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t buf_cond = PTHREAD_COND_INITIALIZER;
+
+static struct {
+	uint64_t samples;
+	uint64_t missed;		// from timestamp gaps
+	uint64_t stalls;		// both buffers full, waited for the writer
+	uint64_t bytes;
+	int64_t first_ts, last_ts;
+	int64_t period_ns;
+	uint64_t win_samples;		// since the last report
+	int64_t win_start;
+	int write_error;
+} stats;
+
+static int write_all(int fd, const char *p, size_t len)
+{
+	while (len) {
+		ssize_t n = write(fd, p, len);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+// Flushes buffers in the order they were handed over : 0, 1, 0, 1 ...
+static void *writer_thread(void *arg)
+{
+	int w = 0;
+
+	(void)arg;
+	for (;;) {
+		pthread_mutex_lock(&buf_lock);
+		while (!bufs[w].full && !finish)
+			pthread_cond_wait(&buf_cond, &buf_lock);
+		if (!bufs[w].full) {
+			pthread_mutex_unlock(&buf_lock);
+			break;
+		}
+		pthread_mutex_unlock(&buf_lock);
+
+		if (!stats.write_error &&
+		    write_all(out_fd, bufs[w].data, bufs[w].len) < 0) {
+			perror("write");
+			stats.write_error = 1;
+			stop = 1;
+		}
+		stats.bytes += bufs[w].len;
+
+		pthread_mutex_lock(&buf_lock);
+		bufs[w].len = 0;
+		bufs[w].full = 0;
+		pthread_cond_broadcast(&buf_cond);
+		pthread_mutex_unlock(&buf_lock);
+		w ^= 1;
+	}
+	return NULL;
+}
+
+// Hand the current buffer to the writer and switch to the other one
+static void submit(void)
+{
+	pthread_mutex_lock(&buf_lock);
+	bufs[cur].full = 1;
+	pthread_cond_broadcast(&buf_cond);
+	cur ^= 1;
+	if (bufs[cur].full)
+		stats.stalls++;
+	while (bufs[cur].full)
+		pthread_cond_wait(&buf_cond, &buf_lock);
+	pthread_mutex_unlock(&buf_lock);
+}
+
+// Room for at least one record in the current buffer, returns the record count
+static size_t reserve(struct adxl345_sample **p)
+{
+	size_t room = (buf_size - bufs[cur].len) / sizeof(**p);
+
+	if (!room) {
+		submit();
+		room = buf_size / sizeof(**p);
+	}
+	*p = (struct adxl345_sample *)(bufs[cur].data + bufs[cur].len);
+	return room;
+}
+
+static void commit(const struct adxl345_sample *s, size_t n)
+{
+	size_t i;
 
-void main() 
+	for (i = 0; i < n; i++) {
+		int64_t ts = s[i].timestamp;
+
+		if (!stats.samples && !i) {
+			stats.first_ts = ts;
+			stats.win_start = ts;
+		} else if (ts - stats.last_ts > stats.period_ns * 3 / 2) {
+			stats.missed += (ts - stats.last_ts + stats.period_ns / 2) /
+					stats.period_ns - 1;
+		}
+		stats.last_ts = ts;
+	}
+	stats.samples += n;
+	stats.win_samples += n;
+	bufs[cur].len += n * sizeof(*s);
+}
+
+static void put_samples(const struct adxl345_sample *s, size_t n)
+{
+	struct adxl345_sample *d;
+	size_t room;
+
+	while (n) {
+		room = reserve(&d);
+		if (room > n)
+			room = n;
+		memcpy(d, s, room * sizeof(*s));
+		commit(s, room);
+		s += room;
+		n -= room;
+	}
+}
+
+// ---------------------------------------------------------------- driver side
+
+static char iio_dir[256];
+
+static int iio_find(void)
+{
+	glob_t g;
+	size_t i;
+	int found = -1;
+
+	if (glob("/sys/bus/iio/devices/iio:device*/name", 0, NULL, &g))
+		return -1;
+	for (i = 0; i < g.gl_pathc && found < 0; i++) {
+		char name[32] = {0};
+		FILE *f = fopen(g.gl_pathv[i], "r");
+
+		if (!f)
+			continue;
+		if (fgets(name, sizeof(name), f) && !strcmp(name, "adxl345\n")) {
+			snprintf(iio_dir, sizeof(iio_dir), "%s", g.gl_pathv[i]);
+			*strrchr(iio_dir, '/') = 0;
+			found = 0;
+		}
+		fclose(f);
+	}
+	globfree(&g);
+	return found;
+}
+
+static int sysfs_write(const char *attr, const char *val)
 {
-	// Create I2C bus
-	int file;
-	char *bus = "/dev/i2c-2";
-	if ((file = open(bus, O_RDWR)) < 0) 
-	{
-		printf("Failed to open the bus. \n");
+	char path[320];
+	FILE *f;
+	int ret;
+
+	snprintf(path, sizeof(path), "%s/%s", iio_dir, attr);
+	f = fopen(path, "w");
+	if (!f)
+		return -1;
+	ret = fputs(val, f) < 0 ? -1 : 0;
+	if (fclose(f))
+		ret = -1;
+	if (ret)
+		fprintf(stderr, "%s <- %s : %s\n", path, val, strerror(errno));
+	return ret;
+}
+
+static int sysfs_read(const char *attr, char *val, int len)
+{
+	char path[320];
+	FILE *f;
+	int ret;
+
+	snprintf(path, sizeof(path), "%s/%s", iio_dir, attr);
+	f = fopen(path, "r");
+	if (!f)
+		return -1;
+	ret = fgets(val, len, f) ? 0 : -1;
+	fclose(f);
+	return ret;
+}
+
+static uint32_t driver_setup(void)
+{
+	char val[64];
+	double scale;
+
+	if (iio_find()) {
+		fprintf(stderr, "no adxl345 IIO device, is adxl345.ko loaded?\n");
 		exit(1);
 	}
-	// Get I2C device, ADXL345 I2C address is 0x53(83)
-	ioctl(file, I2C_SLAVE, 0x53);
-
-	// Select Bandwidth rate register(0x2C)
-	// Normal mode, Output data rate = 100 Hz(0x0A)
-	char config[2]={0};
-	config[0] = 0x2C;
-	config[1] = 0x0A;
-	write(file, config, 2);
-	// Select Power control register(0x2D)
-	// Auto-sleep disable(0x08)
-	config[0] = 0x2D;
-	config[1] = 0x08;
-	write(file, config, 2);
-	// Select Data format register(0x31)
-	// Self test disabled, 4-wire interface, Full resolution, range = +/-2g(0x08)
-	config[0] = 0x31;
-	config[1] = 0x08;
-	write(file, config, 2);
-	sleep(1);
-
-	// Read 6 bytes of data from register(0x32)
-	// xAccl lsb, xAccl msb, yAccl lsb, yAccl msb, zAccl lsb, zAccl msb
-	char reg[1] = {0x32};
-	write(file, reg, 1);
-	char data[6] ={0};
-	if(read(file, data, 6) != 6)
-	{
-		printf("Erorr : Input/output Erorr \n");
+	snprintf(val, sizeof(val), "%.2f", rate);
+	if (sysfs_write("in_accel_sampling_frequency", val))
 		exit(1);
+	// Records come out at rate / dec, the gap check and header follow that
+	if (!sysfs_read("filter_decimation", val, sizeof(val)) && atoi(val) > 0)
+		dec = atoi(val);
+	// ~50 ms of samples per wakeup, 4 s of slack in the ring
+	snprintf(val, sizeof(val), "%u",
+		 rate / dec >= 40 ? (unsigned)(rate / dec / 20) : 1);
+	sysfs_write("ring_watermark", val);
+	sysfs_write("ring_size", rate > 800 ? "16384" : "4096");
+	if (!sysfs_read("stream_index", val, sizeof(val))) {
+		snprintf(ring_dev, sizeof(ring_dev), "/dev/adxl345_ring%d",
+			 atoi(val));
+		snprintf(stream_dev, sizeof(stream_dev), "/dev/adxl345_stream%d",
+			 atoi(val));
 	}
-	else
-	{
-		// Convert the data to 10-bits
-		int xAccl = ((data[1] & 0x03) * 256 + (data[0] & 0xFF));
-		if(xAccl > 511)
-		{
-			xAccl -= 1024;
+	if (!sysfs_read("in_accel_scale", val, sizeof(val)) &&
+	    sscanf(val, "%lf", &scale) == 1)
+		return (uint32_t)(scale * 1e9 + 0.5);
+	return FULL_RES_NANO;
+}
+
+// Cumulative since the driver loaded : main() subtracts the value at start
+static unsigned long driver_drops(void)
+{
+	char val[128];
+	unsigned int queued;
+	unsigned long dropped = 0, overruns = 0;
+
+	if (!sysfs_read("fifo_stats", val, sizeof(val)))
+		sscanf(val, "queued %u dropped %lu overruns %lu",
+		       &queued, &dropped, &overruns);
+	return dropped + overruns;
+}
+
+// ---------------------------------------------------------------- sources
+
+static int64_t now_ns(clockid_t clk)
+{
+	struct timespec t;
+
+	clock_gettime(clk, &t);
+	return (int64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static void report(int final);
+
+static int deadline_passed(int64_t deadline)
+{
+	static int64_t next_report;
+	int64_t now = now_ns(CLOCK_MONOTONIC);
+
+	if (!next_report)
+		next_report = now + (int64_t)(report_every * 1e9);
+	if (report_every > 0 && now >= next_report) {
+		report(0);
+		next_report += (int64_t)(report_every * 1e9);
+	}
+	return stop || (deadline && now >= deadline);
+}
+
+// Zero copy from the driver : only the copy into the log buffer remains
+static unsigned long run_ring(int64_t deadline)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	struct adxl345_ring_hdr *hdr;
+	struct adxl345_ring_ctl *ctl;
+	struct adxl345_sample *data;
+	struct pollfd pfd;
+	uint32_t head, tail, size, n;
+	size_t map_size;
+
+	pfd.fd = open(ring_dev, O_RDWR);
+	if (pfd.fd < 0) {
+		perror(ring_dev);
+		exit(1);
+	}
+	pfd.events = POLLIN;
+	// Header and records are read-only, only the tail page is ours
+	hdr = mmap(NULL, page, PROT_READ, MAP_SHARED, pfd.fd, 0);
+	if (hdr == MAP_FAILED || hdr->magic != ADXL345_RING_MAGIC ||
+	    hdr->version != ADXL345_RING_VERSION) {
+		fprintf(stderr, "%s : not an adxl345 ring\n", ring_dev);
+		exit(1);
+	}
+	map_size = hdr->map_size;
+	munmap(hdr, page);
+	hdr = mmap(NULL, map_size, PROT_READ, MAP_SHARED, pfd.fd, 0);
+	if (hdr == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+	ctl = mmap(NULL, page, PROT_READ | PROT_WRITE, MAP_SHARED, pfd.fd,
+		   hdr->ctl_offset);
+	if (ctl == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+	data = (struct adxl345_sample *)((char *)hdr + hdr->data_offset);
+	size = hdr->size;
+	tail = ctl->tail;
+
+	while (!deadline_passed(deadline)) {
+		if (poll(&pfd, 1, 200) < 0 && errno != EINTR)
+			break;
+		head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+		while (tail != head) {
+			n = head - tail;
+			if (n > size - (tail & (size - 1)))
+				n = size - (tail & (size - 1));
+			put_samples(&data[tail & (size - 1)], n);
+			tail += n;
+			// Slots are free for the driver again once copied out
+			__atomic_store_n(&ctl->tail, tail, __ATOMIC_RELEASE);
+		}
+	}
+	// Ring overflows are in fifo_stats as well
+	munmap(ctl, page);
+	munmap(hdr, map_size);
+	close(pfd.fd);
+	return driver_drops();
+}
+
+// read() straight into the log buffer, whole records only
+static unsigned long run_stream(int64_t deadline)
+{
+	struct adxl345_sample *d;
+	struct pollfd pfd;
+	size_t room;
+	ssize_t n;
+
+	pfd.fd = open(stream_dev, O_RDONLY | O_NONBLOCK);
+	if (pfd.fd < 0) {
+		perror(stream_dev);
+		exit(1);
+	}
+	pfd.events = POLLIN;
+	while (!deadline_passed(deadline)) {
+		if (poll(&pfd, 1, 200) <= 0)
+			continue;
+		room = reserve(&d);
+		n = read(pfd.fd, d, room * sizeof(*d));
+		if (n < 0 && errno != EAGAIN && errno != EINTR) {
+			perror("read");
+			break;
+		}
+		if (n > 0)
+			commit(d, n / sizeof(*d));
+	}
+	close(pfd.fd);
+	return driver_drops();
+}
+
+static int i2c_read(int fd, uint8_t reg, uint8_t *buf, int len)
+{
+	struct i2c_msg msg[2] = {
+		{ .addr = ADXL345_ADDR, .flags = 0, .len = 1, .buf = &reg },
+		{ .addr = ADXL345_ADDR, .flags = I2C_M_RD, .len = len, .buf = buf },
+	};
+	struct i2c_rdwr_ioctl_data xfer = { .msgs = msg, .nmsgs = 2 };
+
+	return ioctl(fd, I2C_RDWR, &xfer) == 2 ? 0 : -1;
+}
+
+static int i2c_write(int fd, uint8_t reg, uint8_t val)
+{
+	uint8_t buf[2] = { reg, val };
+
+	return write(fd, buf, 2) == 2 ? 0 : -1;
+}
+
+/*
+ * Without the driver : the sensor FIFO runs in stream mode and is drained
+ * every ~8 samples with one combined write/read per entry. FIFO_STATUS is
+ * sampled first, so the newest entry is stamped with the poll time and the
+ * older ones back dated by one ODR period each.
+ */
+static unsigned long run_i2c(int64_t deadline)
+{
+	struct adxl345_sample s[32];
+	struct timespec nap;
+	unsigned long overruns = 0;
+	uint8_t st, src, d[6];
+	int64_t now, poll_ns;
+	int fd, code, i, n;
+
+	for (code = 6; code <= 15; code++)
+		if ((3200.0 / (1 << (15 - code))) == rate)
+			break;
+	fd = open(bus, O_RDWR);
+	if (fd < 0) {
+		perror(bus);
+		exit(1);
+	}
+	if (ioctl(fd, I2C_SLAVE, ADXL345_ADDR) < 0) {
+		perror("I2C_SLAVE (is adxl345.ko bound? rmmod it or use -s ring)");
+		exit(1);
+	}
+	if (i2c_write(fd, 0x2D, 0x00) ||		// POWER_CTL : standby
+	    i2c_write(fd, 0x2C, code) ||		// BW_RATE
+	    i2c_write(fd, 0x31, 0x08) ||		// DATA_FORMAT : full res, +/-2g
+	    i2c_write(fd, 0x38, 0x00) ||		// FIFO_CTL : bypass, flush
+	    i2c_write(fd, 0x38, 0x80) ||		// FIFO_CTL : stream
+	    i2c_write(fd, 0x2D, 0x08)) {		// POWER_CTL : measure
+		perror("configure");
+		exit(1);
+	}
+
+	poll_ns = stats.period_ns * 8;
+	if (poll_ns > 50000000)
+		poll_ns = 50000000;
+	nap.tv_sec = poll_ns / 1000000000;
+	nap.tv_nsec = poll_ns % 1000000000;
+
+	while (!deadline_passed(deadline)) {
+		nanosleep(&nap, NULL);
+		if (i2c_read(fd, 0x30, &src, 1) || i2c_read(fd, 0x39, &st, 1))
+			break;
+		now = now_ns(CLOCK_MONOTONIC);
+		if (src & 0x01)				// INT_SOURCE : overrun
+			overruns++;
+		n = st & 0x3F;
+		if (n > 32)
+			n = 32;
+		for (i = 0; i < n; i++) {
+			if (i2c_read(fd, 0x32, d, 6))
+				break;
+			s[i].timestamp = now - (int64_t)(n - 1 - i) * stats.period_ns;
+			s[i].x = (int16_t)(d[0] | d[1] << 8);
+			s[i].y = (int16_t)(d[2] | d[3] << 8);
+			s[i].z = (int16_t)(d[4] | d[5] << 8);
+			s[i].pad = 0;
 		}
+		put_samples(s, i);
+	}
+	i2c_write(fd, 0x38, 0x00);
+	close(fd);
+	return overruns;
+}
 
-		int yAccl = ((data[3] & 0x03) * 256 + (data[2] & 0xFF));
-		if(yAccl > 511)
-		{
-			yAccl -= 1024;
+// ---------------------------------------------------------------- main
+
+static void report(int final)
+{
+	double span = (stats.last_ts - stats.first_ts) / 1e9;
+	double win = (stats.last_ts - stats.win_start) / 1e9;
+
+	if (final)
+		printf("%llu samples in %.3f s : %.2f Hz (requested %.2f), "
+		       "%llu missed, %llu writer stalls, %llu bytes\n",
+		       (unsigned long long)stats.samples, span,
+		       span > 0 ? (stats.samples - 1) / span : 0.0, rate / dec,
+		       (unsigned long long)stats.missed,
+		       (unsigned long long)stats.stalls,
+		       (unsigned long long)stats.bytes);
+	else
+		printf("%llu samples, %.2f Hz, %llu missed\n",
+		       (unsigned long long)stats.samples,
+		       win > 0 ? stats.win_samples / win : 0.0,
+		       (unsigned long long)stats.missed);
+	fflush(stdout);
+	stats.win_samples = 0;
+	stats.win_start = stats.last_ts;
+}
+
+static void on_signal(int sig)
+{
+	(void)sig;
+	stop = 1;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-s ring|stream|i2c] [-o file] [-r Hz] [-d seconds]\n"
+		"          [-b i2c-bus] [-B buffer KiB] [-i report seconds]\n"
+		"  Hz : 6.25 12.5 25 50 100 200 400 800 1600 3200\n", prog);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	struct adxl345_log_hdr hdr;
+	unsigned long drops = 0, drops_base = 0;
+	pthread_t writer;
+	int64_t deadline = 0;
+	int c, k;
+
+	while ((c = getopt(argc, argv, "s:o:r:d:b:B:i:h")) != -1) {
+		switch (c) {
+		case 's': source = optarg; break;
+		case 'o': out_path = optarg; break;
+		case 'r': rate = atof(optarg); break;
+		case 'd': duration = atof(optarg); break;
+		case 'b': bus = optarg; break;
+		case 'B': buf_size = (size_t)atoi(optarg) << 10; break;
+		case 'i': report_every = atof(optarg); break;
+		default: usage(argv[0]);
 		}
+	}
+	for (k = 0; k <= 9; k++)
+		if (6.25 * (1 << k) == rate)
+			break;
+	if (k > 9 || buf_size < 4096)
+		usage(argv[0]);
+	buf_size &= ~(size_t)4095;
 
-		int zAccl = ((data[5] & 0x03) * 256 + (data[4] & 0xFF));
-		if(zAccl > 511)
-		{
-			zAccl -= 1024;
+	for (k = 0; k < 2; k++)
+		if (posix_memalign((void **)&bufs[k].data, 4096, buf_size)) {
+			fprintf(stderr, "out of memory\n");
+			return 1;
 		}
+	out_fd = open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (out_fd < 0) {
+		perror(out_path);
+		return 1;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = ADXL345_LOG_MAGIC;
+	hdr.record_size = sizeof(struct adxl345_sample);
+	if (strcmp(source, "i2c")) {
+		hdr.scale_nano = driver_setup();
+		drops_base = driver_drops();
+	} else {
+		hdr.scale_nano = FULL_RES_NANO;
+	}
+	// One output period : ODR / filter_decimation (always 1 for -s i2c)
+	stats.period_ns = (int64_t)(1e9 * dec / rate);
+	hdr.rate_mhz = (uint32_t)(rate * 1000 / dec);
+	hdr.start_monotonic = now_ns(CLOCK_MONOTONIC);
+	hdr.start_realtime = now_ns(CLOCK_REALTIME);
+	memcpy(bufs[0].data, &hdr, sizeof(hdr));
+	bufs[0].len = sizeof(hdr);
 
-		// Output data to screen
-		printf("Acceleration in X-Axis : %d \n", xAccl);
-		printf("Acceleration in Y-Axis : %d \n", yAccl);
-		printf("Acceleration in Z-Axis : %d \n", zAccl);
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+	if (pthread_create(&writer, NULL, writer_thread, NULL)) {
+		fprintf(stderr, "can not start the writer thread\n");
+		return 1;
 	}
+	if (duration > 0)
+		deadline = now_ns(CLOCK_MONOTONIC) + (int64_t)(duration * 1e9);
+
+	if (!strcmp(source, "ring"))
+		drops = run_ring(deadline);
+	else if (!strcmp(source, "stream"))
+		drops = run_stream(deadline);
+	else if (!strcmp(source, "i2c"))
+		drops = run_i2c(deadline);
+	else
+		usage(argv[0]);
+
+	// Flush the partial buffer, then let the writer drain and exit
+	pthread_mutex_lock(&buf_lock);
+	bufs[cur].full = 1;
+	finish = 1;
+	pthread_cond_broadcast(&buf_cond);
+	pthread_mutex_unlock(&buf_lock);
+	pthread_join(writer, NULL);
+	if (fsync(out_fd) < 0 || close(out_fd) < 0)
+		stats.write_error = 1;
+
+	drops -= drops_base;
+	report(1);
+	printf("%lu dropped/overrun in the %s path\n", drops, source);
+	return stats.write_error || stats.missed || drops ? 2 : 0;
 }
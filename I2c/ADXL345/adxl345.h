@@ -0,0 +1,75 @@
+#ifndef _ADXL345_H_
+#define _ADXL345_H_
+
+#include <linux/regmap.h>
+#include <linux/interrupt.h>
+
+/*
+ * Bus agnostic ADXL345 core (adxl345_core.ko). The I2C (I2c/ADXL345) and SPI
+ * (SPI/ADXL345) binding modules only build a regmap for their bus and hand
+ * it to adxl345_core_probe(); everything else lives in the core.
+ */
+
+/* The adxl345 registers */
+enum ADXL345_Reg {
+	DEVID		= 0x00,		// Device ID, 0xE5.
+	THRESH_TAP	= 0x1D,		// Tap threshold, 62.5 mg/LSB.
+	DUR		= 0x21,		// Tap duration, 625 us/LSB.
+	LATENT		= 0x22,		// Tap latency, 1.25 ms/LSB.
+	WINDOW		= 0x23,		// Tap window, 1.25 ms/LSB.
+	THRESH_ACT	= 0x24,		// Activity threshold, 62.5 mg/LSB.
+	THRESH_INACT	= 0x25,		// Inactivity threshold, 62.5 mg/LSB.
+	TIME_INACT	= 0x26,		// Inactivity time, 1 s/LSB.
+	ACT_INACT_CTL	= 0x27,		// Axis enable control for activity and inactivity detection.
+	THRESH_FF	= 0x28,		// Free-fall threshold, 62.5 mg/LSB.
+	TIME_FF		= 0x29,		// Free-fall time, 5 ms/LSB.
+	TAP_AXES	= 0x2A,		// Axis control for single tap/double tap.
+	ACT_TAP_STATUS	= 0x2B,		// Source of single tap/double tap and activity.
+	BW_RATE		= 0x2C, 	// Bandwidth rate register(0x2C) : Data rate and power mode control.
+	POWER_CTL	= 0x2D,		// Power-saving features control.Power control register
+	INT_ENABLE	= 0x2E,		// Interrupt enable control.
+	INT_MAP		= 0x2F,		// Interrupt mapping control : 0 = INT1, 1 = INT2.
+	INT_SOURCE	= 0x30,		// Source of interrupts, reading it clears them.
+	DATA_FORMAT	= 0x31, 	// Select Data format register(0x31): Data format control.
+	FIFO_CTL	= 0x38,		// FIFO control : mode, trigger, watermark.
+	FIFO_STATUS	= 0x39,		// FIFO status : entries queued.
+};
+
+enum Axis_reg {
+	DATAX0		= 0x32,
+	DATAX1		= 0x33,
+	DATAY0		= 0x34,
+	DATAY1		= 0x35,
+	DATAZ0		= 0x36,
+	DATAZ1		= 0x37,
+};
+
+/* SPI : bit 7 = read, bit 6 = multi-byte (auto increment) */
+#define ADXL345_SPI_READ	0x80
+#define ADXL345_SPI_MB		0x40
+
+#define ADXL345_FIFO_MAX	32	/* FIFO entries a drain may return */
+
+/*
+ * Optional bus fast path for the FIFO stream (SPI : spi_async, see
+ * SPI/ADXL345/adxl345.c). While /dev/adxl345_stream<N> is open the core hands
+ * every INT1 edge to irq() in hard IRQ context instead of waking its
+ * thread; the bus reads INT_SOURCE, FIFO_STATUS and the FIFO on its own and
+ * feeds the result back through adxl345_core_push().
+ */
+struct adxl345_fastpath {
+	int (*start)(void *priv, unsigned int watermark);	/* may sleep */
+	void (*stop)(void *priv);	/* returns with nothing in flight */
+	irqreturn_t (*irq)(void *priv, s64 timestamp);
+	void *priv;
+};
+
+extern const struct regmap_config adxl345_regmap_config;
+
+int adxl345_core_probe(struct device *dev, struct regmap *regmap, int irq,
+		       const char *name, const struct adxl345_fastpath *fast);
+int adxl345_core_remove(struct device *dev);
+void adxl345_core_push(struct device *dev, unsigned int int_source,
+		       s16 (*xyz)[3], unsigned int n, s64 timestamp);
+
+#endif /* _ADXL345_H_ */
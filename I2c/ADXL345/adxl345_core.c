@@ -0,0 +1,1946 @@
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/log2.h>
+#include <linux/kernel.h>
+#include <linux/regmap.h>
+#include <linux/interrupt.h>
+#include <linux/kfifo.h>
+#include <linux/cdev.h>
+#include <linux/fs.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/kref.h>
+#include <linux/ktime.h>
+#include <linux/hrtimer.h>
+#include <linux/device.h>
+#include <linux/idr.h>
+#include <linux/iio/iio.h>
+#include <linux/iio/sysfs.h>
+#include <linux/iio/events.h>
+#include <linux/iio/buffer.h>
+#include <linux/iio/trigger.h>
+#include <linux/iio/trigger_consumer.h>
+#include <linux/iio/triggered_buffer.h>
+
+#include "adxl345.h"
+#include "adxl345_ring.h"
+
+#define ADXL345_KFIFO_SIZE	1024	/* samples, power of 2 */
+#define ADXL345_RING_MIN	64	/* records, power of 2 */
+#define ADXL345_RING_MAX	65536
+#define ADXL345_STREAM_DEVS	8	/* sensors with stream/ring nodes */
+
+/* 13 bit input + N * log2(R) of CIC growth must fit the 32 bit registers */
+#define ADXL345_CIC_MAX_ORDER	3
+#define ADXL345_CIC_MAX_DEC	64
+
+struct adxl345_prv {
+	struct device *dev;
+	struct regmap *regmap;		/* config registers served from its cache */
+	struct kref ref;		/* probe + one per open stream/ring file */
+	bool dead;			/* removed, under lock */
+	struct mutex lock;		/* one-shot reads vs. buffer/stream enable */
+	/* IIO triggers : data-ready on INT1 and a free running hrtimer */
+	struct iio_trigger *dready_trig;
+	struct iio_trigger *hrtimer_trig;
+	struct hrtimer timer;
+	ktime_t period;
+	/* Output format, see adxl345_set_rate() / adxl345_set_format() */
+	u8 rate;			/* BW_RATE[3:0] */
+	u8 range;			/* DATA_FORMAT[1:0] : 2g << range */
+	bool full_res;
+	int scale;			/* u(m/s^2) per LSB for range/full_res */
+	s64 period_ns;			/* one ODR period */
+	/* Motion events : enabled axes per adxl345_ev kind, ADXL345_AXIS_* bits */
+	u8 ev_axes[5];
+	/* Processing stage, see adxl345_filter() */
+	unsigned int dec;		/* decimation R, 1 = pass through */
+	unsigned int order;		/* CIC stages N, 1 = boxcar average */
+	s32 gain;			/* R^N */
+	unsigned int phase;
+	u32 integ[ADXL345_CIC_MAX_ORDER][3];
+	u32 comb[ADXL345_CIC_MAX_ORDER][3];
+	s32 calibbias[3];		/* LSB */
+	u32 calibscale[3];		/* Q16.16 */
+	bool dready_on;
+	/* Scan : X, Y, Z as read from DATAX0.. then the aligned timestamp */
+	struct {
+		__le16 axes[3];
+		s64 ts __aligned(8);
+	} scan;
+	/* FIFO streaming, see adxl345_irq_thread() */
+	int irq;
+	ktime_t irq_ts;
+	u8 watermark;
+	unsigned long stream_busy;
+	unsigned long dropped;
+	unsigned long overruns;
+	DECLARE_KFIFO(fifo, struct adxl345_sample, ADXL345_KFIFO_SIZE);
+	wait_queue_head_t wait;
+	struct mutex read_lock;
+	/* Bus fast path, see struct adxl345_fastpath */
+	const struct adxl345_fastpath *fast;
+	bool fast_on;
+	spinlock_t motion_lock;
+	/* Producers : the IRQ thread and the fast path's fallback can overlap */
+	spinlock_t push_lock;
+	unsigned int motion_src;	/* INT_SOURCE bits for motion_work */
+	struct work_struct motion_work;
+	/* Shared ring behind /dev/adxl345_ring<N>, NULL unless that is open */
+	struct adxl345_ring_hdr *ring;
+	struct adxl345_ring_ctl *ring_ctl;
+	struct adxl345_sample *ring_data;
+	u32 ring_head;			/* the header only gets copies of these */
+	u32 ring_mask;			/* size of the open ring - 1 */
+	size_t ring_map_size;
+	u32 ring_dropped;
+	unsigned int ring_size;		/* records for the next open */
+	unsigned int ring_watermark;	/* POLLIN threshold, records */
+	int index;			/* N in adxl345_stream<N> / adxl345_ring<N> */
+	dev_t devt;
+	struct cdev cdev;
+	struct cdev ring_cdev;
+};
+
+/* Shared by every sensor : two minors each, picked by index */
+static dev_t adxl345_devt;
+static struct class *adxl345_class;
+static DEFINE_IDA(adxl345_ida);
+
+
+/* INT_ENABLE / INT_MAP / INT_SOURCE bits */
+enum ADXL345_Int {
+	INT_OVERRUN	= 1 << 0,
+	INT_WATERMARK	= 1 << 1,
+	INT_FREE_FALL	= 1 << 2,
+	INT_INACTIVITY	= 1 << 3,
+	INT_ACTIVITY	= 1 << 4,
+	INT_DOUBLE_TAP	= 1 << 5,
+	INT_SINGLE_TAP	= 1 << 6,
+	INT_DATA_READY	= 1 << 7,
+};
+
+#define INT_MOTION	(INT_FREE_FALL | INT_INACTIVITY | INT_ACTIVITY | \
+			 INT_DOUBLE_TAP | INT_SINGLE_TAP)
+
+#define FIFO_MODE_STREAM	(2 << 6)	/* FIFO_CTL[7:6] = 10 */
+#define FIFO_ENTRIES_MASK	0x3F
+#define FIFO_ENTRIES_MAX	31
+
+/* Full resolution : 3.9 mg/LSB in every range, in m/s^2 */
+#define ADXL345_USCALE		38246
+
+/* BW_RATE / DATA_FORMAT fields */
+#define BW_RATE_MASK		0x0F
+#define BW_RATE_MIN		0x06	/* 6.25 Hz */
+#define BW_RATE_MAX		0x0F	/* 3200 Hz */
+#define BW_RATE_DEFAULT		0x0A	/* 100 Hz */
+#define POWER_CTL_MEASURE	(1 << 3)
+#define DATA_FORMAT_FULL_RES	(1 << 3)
+#define DATA_FORMAT_RANGE	0x03
+
+/*
+ * u(m/s^2) per LSB. Full resolution keeps 3.9 mg/LSB and widens the word
+ * with the range (10 to 13 bits), fixed 10 bit mode doubles the step instead.
+ */
+static const int adxl345_scale_tbl[2][4] = {
+	{ ADXL345_USCALE, ADXL345_USCALE << 1,
+	  ADXL345_USCALE << 2, ADXL345_USCALE << 3 },
+	{ ADXL345_USCALE, ADXL345_USCALE,
+	  ADXL345_USCALE, ADXL345_USCALE },
+};
+
+/*
+ * Only the data, interrupt source and FIFO status registers change behind
+ * our back. Everything else is cached after the first access, so config
+ * reads (BW_RATE, DATA_FORMAT, INT_MAP, INT_ENABLE ...) never hit the bus.
+ */
+static bool adxl345_volatile_reg(struct device *dev, unsigned int reg)
+{
+	switch (reg) {
+	case DATAX0 ... DATAZ1:
+	case ACT_TAP_STATUS:
+	case INT_SOURCE:
+	case FIFO_STATUS:
+		return true;
+	}
+	return false;
+}
+
+const struct regmap_config adxl345_regmap_config = {
+	.reg_bits	= 8,
+	.val_bits	= 8,
+	.max_register	= FIFO_STATUS,
+	.volatile_reg	= adxl345_volatile_reg,
+	.cache_type	= REGCACHE_RBTREE,
+};
+EXPORT_SYMBOL_GPL(adxl345_regmap_config);
+
+/*
+ * DATAX0..DATAZ1 are consecutive, so one 6 byte bulk read returns a whole
+ * X/Y/Z sample in a single bus transaction (I2C block read, SPI burst with
+ * the MB bit). The device latches the data registers during a multi-byte
+ * read, so the three axes can not tear.
+ */
+static int adxl345_read_xyz(struct adxl345_prv *st, s16 xyz[3])
+{
+	__le16 data[3];
+	int ret, i;
+
+	ret = regmap_bulk_read(st->regmap, DATAX0, data, sizeof(data));
+	if (ret)
+		return ret;
+	/* Right justified and sign extended to 16 bits */
+	for (i = 0; i < 3; i++)
+		xyz[i] = (s16)le16_to_cpu(data[i]);
+	return 0;
+}
+
+/* BW_RATE rate code 0xF is 3200 Hz, every step below halves it */
+static u64 adxl345_rate_uhz(unsigned int rate)
+{
+	return 3200000000ULL >> (BW_RATE_MAX - rate);
+}
+
+/*
+ * Setters keep the cached copy (rate, range, full_res) and everything
+ * derived from it (scale, period_ns) in step with the chip, so the sample
+ * paths never touch BW_RATE or DATA_FORMAT. Callers hold st->lock.
+ */
+static int adxl345_set_rate(struct adxl345_prv *st, unsigned int rate)
+{
+	int ret;
+
+	ret = regmap_update_bits(st->regmap, BW_RATE, BW_RATE_MASK, rate);
+	if (ret)
+		return ret;
+	st->rate = rate;
+	st->period_ns = div64_u64(1000000000000000ULL, adxl345_rate_uhz(rate));
+	st->period = ns_to_ktime(st->period_ns);
+	return 0;
+}
+
+static int adxl345_set_format(struct adxl345_prv *st, unsigned int range,
+			      bool full_res)
+{
+	int ret;
+
+	ret = regmap_update_bits(st->regmap, DATA_FORMAT,
+				 DATA_FORMAT_FULL_RES | DATA_FORMAT_RANGE,
+				 (full_res ? DATA_FORMAT_FULL_RES : 0) | range);
+	if (ret)
+		return ret;
+	st->range = range;
+	st->full_res = full_res;
+	st->scale = adxl345_scale_tbl[full_res][range];
+	return 0;
+}
+
+/* Rate and format only change while nothing is sampling at the old setting */
+static int adxl345_config_lock(struct iio_dev *indio_dev)
+{
+	struct adxl345_prv *st = iio_priv(indio_dev);
+
+	mutex_lock(&st->lock);
+	if (iio_buffer_enabled(indio_dev) || test_bit(0, &st->stream_busy)) {
+		mutex_unlock(&st->lock);
+		return -EBUSY;
+	}
+	return 0;
+}
+
+/*
+ * Processing stage
+ *
+ * Samples bound for the IIO buffer or the stream device pass through an
+ * N stage CIC decimator (N = 1 is a plain R sample average) and then the
+ * per axis calibbias / calibscale correction, all in integer arithmetic.
+ * Only every R'th input produces an output, so consumers see ODR / R
+ * samples. The integrators wrap modulo 2^32 by design : the comb stages
+ * cancel the wrap as long as the true output fits, which the limits above
+ * guarantee. Runs only from the one active sample path, under no lock.
+ */
+static void adxl345_filter_reset(struct adxl345_prv *st)
+{
+	memset(st->integ, 0, sizeof(st->integ));
+	memset(st->comb, 0, sizeof(st->comb));
+	st->phase = 0;
+}
+
+static s16 adxl345_correct(struct adxl345_prv *st, int axis, s32 val)
+{
+	s64 v = ((s64)(val + st->calibbias[axis]) * st->calibscale[axis]) >> 16;
+
+	return clamp_t(s64, v, S16_MIN, S16_MAX);
+}
+
+/* Feed one sample; true when xyz now holds a decimated, corrected output */
+static bool adxl345_filter(struct adxl345_prv *st, s16 xyz[3])
+{
+	unsigned int k, i;
+	u32 y, t;
+
+	if (st->dec == 1) {
+		for (i = 0; i < 3; i++)
+			xyz[i] = adxl345_correct(st, i, xyz[i]);
+		return true;
+	}
+
+	for (i = 0; i < 3; i++) {
+		st->integ[0][i] += (u32)(s32)xyz[i];
+		for (k = 1; k < st->order; k++)
+			st->integ[k][i] += st->integ[k - 1][i];
+	}
+	if (++st->phase < st->dec)
+		return false;
+	st->phase = 0;
+
+	for (i = 0; i < 3; i++) {
+		y = st->integ[st->order - 1][i];
+		for (k = 0; k < st->order; k++) {
+			t = y;
+			y -= st->comb[k][i];
+			st->comb[k][i] = t;
+		}
+		xyz[i] = adxl345_correct(st, i,
+					 DIV_ROUND_CLOSEST((s32)y, st->gain));
+	}
+	return true;
+}
+
+static void adxl345_filter_setup(struct adxl345_prv *st, unsigned int dec,
+				 unsigned int order)
+{
+	unsigned int k;
+
+	st->dec = dec;
+	st->order = order;
+	st->gain = 1;
+	for (k = 0; k < order; k++)
+		st->gain *= dec;
+	adxl345_filter_reset(st);
+}
+
+#define ADXL345_CHANNEL(_axis, _reg, _si, _ev, _nev) {		\
+	.type = IIO_ACCEL,						\
+	.modified = 1,							\
+	.channel2 = IIO_MOD_##_axis,					\
+	.address = _reg,						\
+	.info_mask_separate = BIT(IIO_CHAN_INFO_RAW) |			\
+			      BIT(IIO_CHAN_INFO_CALIBBIAS) |		\
+			      BIT(IIO_CHAN_INFO_CALIBSCALE),		\
+	.info_mask_shared_by_type = BIT(IIO_CHAN_INFO_SCALE),		\
+	.info_mask_shared_by_all = BIT(IIO_CHAN_INFO_SAMP_FREQ),	\
+	.scan_index = _si,						\
+	.scan_type = {							\
+		.sign = 's',						\
+		.realbits = 16,	/* corrected/decimated, clamped to s16 */	\
+		.storagebits = 16,					\
+		.endianness = IIO_LE,					\
+	},								\
+	.event_spec = _ev,						\
+	.num_event_specs = _nev,					\
+}
+
+/*
+ * Motion engines as IIO events (4.4 has no gesture event type, so taps
+ * are reported as magnitude events):
+ *   activity    in_accel_{x,y,z}_thresh_rising_en		THRESH_ACT
+ *   inactivity  in_accel_{x,y,z}_thresh_falling_en		THRESH_INACT, TIME_INACT
+ *   single tap  in_accel_{x,y,z}_mag_rising_en		THRESH_TAP, DUR
+ *   double tap  in_accel_{x,y,z}_mag_adaptive_rising_en	THRESH_TAP, WINDOW, LATENT
+ *   free-fall   in_accel_x&y&z_mag_falling_en		THRESH_FF, TIME_FF
+ * Thresholds are in m/s^2, periods in seconds. Single and double tap
+ * share THRESH_TAP.
+ */
+static const struct iio_event_spec adxl345_axis_events[] = {
+	{
+		.type = IIO_EV_TYPE_THRESH,
+		.dir = IIO_EV_DIR_RISING,
+		.mask_separate = BIT(IIO_EV_INFO_ENABLE),
+		.mask_shared_by_type = BIT(IIO_EV_INFO_VALUE),
+	}, {
+		.type = IIO_EV_TYPE_THRESH,
+		.dir = IIO_EV_DIR_FALLING,
+		.mask_separate = BIT(IIO_EV_INFO_ENABLE),
+		.mask_shared_by_type = BIT(IIO_EV_INFO_VALUE) |
+				       BIT(IIO_EV_INFO_PERIOD),
+	}, {
+		.type = IIO_EV_TYPE_MAG,
+		.dir = IIO_EV_DIR_RISING,
+		.mask_separate = BIT(IIO_EV_INFO_ENABLE),
+		.mask_shared_by_type = BIT(IIO_EV_INFO_VALUE) |
+				       BIT(IIO_EV_INFO_PERIOD),
+	}, {
+		.type = IIO_EV_TYPE_MAG_ADAPTIVE,
+		.dir = IIO_EV_DIR_RISING,
+		.mask_separate = BIT(IIO_EV_INFO_ENABLE),
+		.mask_shared_by_type = BIT(IIO_EV_INFO_VALUE) |
+				       BIT(IIO_EV_INFO_PERIOD),
+	},
+};
+
+static const struct iio_event_spec adxl345_freefall_event = {
+	.type = IIO_EV_TYPE_MAG,
+	.dir = IIO_EV_DIR_FALLING,
+	.mask_separate = BIT(IIO_EV_INFO_ENABLE) | BIT(IIO_EV_INFO_VALUE) |
+			 BIT(IIO_EV_INFO_PERIOD),
+};
+
+static const struct iio_chan_spec adxl345_channels[] = {
+	ADXL345_CHANNEL(X, DATAX0, 0, NULL, 0),
+	ADXL345_CHANNEL(Y, DATAY0, 1, NULL, 0),
+	ADXL345_CHANNEL(Z, DATAZ0, 2, NULL, 0),
+	IIO_CHAN_SOFT_TIMESTAMP(3),
+};
+
+/* With INT1 wired : same scan layout plus the motion events */
+static const struct iio_chan_spec adxl345_event_channels[] = {
+	ADXL345_CHANNEL(X, DATAX0, 0, adxl345_axis_events,
+			ARRAY_SIZE(adxl345_axis_events)),
+	ADXL345_CHANNEL(Y, DATAY0, 1, adxl345_axis_events,
+			ARRAY_SIZE(adxl345_axis_events)),
+	ADXL345_CHANNEL(Z, DATAZ0, 2, adxl345_axis_events,
+			ARRAY_SIZE(adxl345_axis_events)),
+	IIO_CHAN_SOFT_TIMESTAMP(3),
+	{
+		.type = IIO_ACCEL,
+		.modified = 1,
+		.channel2 = IIO_MOD_X_AND_Y_AND_Z,
+		.scan_index = -1,
+		.event_spec = &adxl345_freefall_event,
+		.num_event_specs = 1,
+	},
+};
+
+/* X, Y and Z always come from one burst, the core demuxes subsets */
+static const unsigned long adxl345_scan_masks[] = { 0x7, 0 };
+
+static int adxl345_read_raw(struct iio_dev *indio_dev,
+			    struct iio_chan_spec const *chan,
+			    int *val, int *val2, long mask)
+{
+	struct adxl345_prv *st = iio_priv(indio_dev);
+	__le16 data;
+	int ret;
+
+	switch (mask) {
+	case IIO_CHAN_INFO_RAW:
+		mutex_lock(&st->lock);
+		/* DATAX0.. pop the FIFO / belong to the buffer while it runs */
+		if (iio_buffer_enabled(indio_dev) ||
+		    test_bit(0, &st->stream_busy)) {
+			mutex_unlock(&st->lock);
+			return -EBUSY;
+		}
+		ret = regmap_bulk_read(st->regmap, chan->address, &data,
+				       sizeof(data));
+		mutex_unlock(&st->lock);
+		if (ret)
+			return ret;
+		*val = adxl345_correct(st, chan->scan_index,
+				       (s16)le16_to_cpu(data));
+		return IIO_VAL_INT;
+	case IIO_CHAN_INFO_CALIBBIAS:
+		*val = st->calibbias[chan->scan_index];
+		return IIO_VAL_INT;
+	case IIO_CHAN_INFO_CALIBSCALE:
+		*val = st->calibscale[chan->scan_index] >> 16;
+		*val2 = ((u64)(st->calibscale[chan->scan_index] & 0xFFFF) *
+			 1000000) >> 16;
+		return IIO_VAL_INT_PLUS_MICRO;
+	case IIO_CHAN_INFO_SCALE:
+		*val = 0;
+		*val2 = st->scale;
+		return IIO_VAL_INT_PLUS_MICRO;
+	case IIO_CHAN_INFO_SAMP_FREQ:
+		*val = div_u64_rem(adxl345_rate_uhz(st->rate), 1000000,
+				   (u32 *)val2);
+		return IIO_VAL_INT_PLUS_MICRO;
+	}
+	return -EINVAL;
+}
+
+static int adxl345_write_raw(struct iio_dev *indio_dev,
+			     struct iio_chan_spec const *chan,
+			     int val, int val2, long mask)
+{
+	struct adxl345_prv *st = iio_priv(indio_dev);
+	unsigned int i;
+	u64 uhz;
+	int ret;
+
+	/* Correction is read per sample without a lock : s32 stores only */
+	switch (mask) {
+	case IIO_CHAN_INFO_CALIBBIAS:
+		if (val < -4096 || val > 4095)
+			return -EINVAL;
+		st->calibbias[chan->scan_index] = val;
+		return 0;
+	case IIO_CHAN_INFO_CALIBSCALE:
+		if (val < 0 || val2 < 0 || val > 7)
+			return -EINVAL;
+		st->calibscale[chan->scan_index] = (val << 16) +
+			div_u64((u64)val2 << 16, 1000000);
+		return 0;
+	}
+
+	if (val < 0 || val2 < 0)
+		return -EINVAL;
+
+	switch (mask) {
+	case IIO_CHAN_INFO_SAMP_FREQ:
+		uhz = (u64)val * 1000000 + val2;
+		for (i = BW_RATE_MIN; i <= BW_RATE_MAX; i++)
+			if (adxl345_rate_uhz(i) == uhz)
+				break;
+		if (i > BW_RATE_MAX)
+			return -EINVAL;
+		ret = adxl345_config_lock(indio_dev);
+		if (ret)
+			return ret;
+		ret = adxl345_set_rate(st, i);
+		mutex_unlock(&st->lock);
+		return ret;
+	case IIO_CHAN_INFO_SCALE:
+		/* In full resolution every range has the same scale : keep range */
+		if (val != 0)
+			return -EINVAL;
+		ret = adxl345_config_lock(indio_dev);
+		if (ret)
+			return ret;
+		if (adxl345_scale_tbl[st->full_res][st->range] == val2) {
+			mutex_unlock(&st->lock);
+			return 0;
+		}
+		for (i = 0; i < ARRAY_SIZE(adxl345_scale_tbl[0]); i++)
+			if (adxl345_scale_tbl[st->full_res][i] == val2)
+				break;
+		if (i < ARRAY_SIZE(adxl345_scale_tbl[0]))
+			ret = adxl345_set_format(st, i, st->full_res);
+		else
+			ret = -EINVAL;
+		mutex_unlock(&st->lock);
+		return ret;
+	}
+	return -EINVAL;
+}
+
+/*
+ * in_accel_range (2, 4, 8, 16 g) and in_accel_full_resolution pick
+ * DATA_FORMAT directly; in_accel_scale follows them. Writing in_accel_scale
+ * in fixed 10 bit mode selects the matching range.
+ */
+static IIO_CONST_ATTR_SAMP_FREQ_AVAIL("6.25 12.5 25 50 100 200 400 800 1600 3200");
+static IIO_CONST_ATTR(in_accel_range_available, "2 4 8 16");
+
+static ssize_t adxl345_scale_available_show(struct device *dev,
+					    struct device_attribute *attr,
+					    char *buf)
+{
+	struct adxl345_prv *st = iio_priv(dev_to_iio_dev(dev));
+	ssize_t len = 0;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(adxl345_scale_tbl[0]); i++) {
+		if (st->full_res && i)
+			break;
+		len += sprintf(buf + len, "0.%06d ",
+			       adxl345_scale_tbl[st->full_res][i]);
+	}
+	buf[len - 1] = '\n';
+	return len;
+}
+
+static ssize_t adxl345_range_show(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	struct adxl345_prv *st = iio_priv(dev_to_iio_dev(dev));
+
+	return sprintf(buf, "%d\n", 2 << st->range);
+}
+static ssize_t adxl345_range_store(struct device *dev,
+				   struct device_attribute *attr,
+				   const char *buf, size_t count)
+{
+	struct iio_dev *indio_dev = dev_to_iio_dev(dev);
+	struct adxl345_prv *st = iio_priv(indio_dev);
+	unsigned int g, range;
+	int ret;
+
+	if (kstrtouint(buf, 0, &g))
+		return -EINVAL;
+	for (range = 0; range < 4; range++)
+		if ((2U << range) == g)
+			break;
+	if (range == 4)
+		return -EINVAL;
+	ret = adxl345_config_lock(indio_dev);
+	if (ret)
+		return ret;
+	ret = adxl345_set_format(st, range, st->full_res);
+	mutex_unlock(&st->lock);
+	return ret ? ret : count;
+}
+
+static ssize_t adxl345_full_res_show(struct device *dev,
+				     struct device_attribute *attr, char *buf)
+{
+	struct adxl345_prv *st = iio_priv(dev_to_iio_dev(dev));
+
+	return sprintf(buf, "%d\n", st->full_res);
+}
+static ssize_t adxl345_full_res_store(struct device *dev,
+				      struct device_attribute *attr,
+				      const char *buf, size_t count)
+{
+	struct iio_dev *indio_dev = dev_to_iio_dev(dev);
+	struct adxl345_prv *st = iio_priv(indio_dev);
+	bool full_res;
+	int ret;
+
+	if (strtobool(buf, &full_res))
+		return -EINVAL;
+	ret = adxl345_config_lock(indio_dev);
+	if (ret)
+		return ret;
+	ret = adxl345_set_format(st, st->range, full_res);
+	mutex_unlock(&st->lock);
+	return ret ? ret : count;
+}
+
+/* filter_decimation (1..64) and filter_order (1..3), see adxl345_filter() */
+static ssize_t adxl345_filter_show(struct device *dev,
+				   struct device_attribute *attr, char *buf)
+{
+	struct adxl345_prv *st = iio_priv(dev_to_iio_dev(dev));
+
+	if (to_iio_dev_attr(attr)->address)
+		return sprintf(buf, "%u\n", st->order);
+	return sprintf(buf, "%u\n", st->dec);
+}
+static ssize_t adxl345_filter_store(struct device *dev,
+				    struct device_attribute *attr,
+				    const char *buf, size_t count)
+{
+	struct iio_dev *indio_dev = dev_to_iio_dev(dev);
+	struct adxl345_prv *st = iio_priv(indio_dev);
+	unsigned int val, dec, order;
+	int ret;
+
+	if (kstrtouint(buf, 0, &val))
+		return -EINVAL;
+	ret = adxl345_config_lock(indio_dev);
+	if (ret)
+		return ret;
+	dec = to_iio_dev_attr(attr)->address ? st->dec : val;
+	order = to_iio_dev_attr(attr)->address ? val : st->order;
+	if (dec < 1 || dec > ADXL345_CIC_MAX_DEC ||
+	    order < 1 || order > ADXL345_CIC_MAX_ORDER)
+		ret = -EINVAL;
+	else
+		adxl345_filter_setup(st, dec, order);
+	mutex_unlock(&st->lock);
+	return ret ? ret : count;
+}
+
+static IIO_DEVICE_ATTR(filter_decimation, 0644,
+		       adxl345_filter_show, adxl345_filter_store, 0);
+static IIO_DEVICE_ATTR(filter_order, 0644,
+		       adxl345_filter_show, adxl345_filter_store, 1);
+
+static IIO_DEVICE_ATTR(in_accel_scale_available, 0444,
+		       adxl345_scale_available_show, NULL, 0);
+static IIO_DEVICE_ATTR(in_accel_range, 0644,
+		       adxl345_range_show, adxl345_range_store, 0);
+static IIO_DEVICE_ATTR(in_accel_full_resolution, 0644,
+		       adxl345_full_res_show, adxl345_full_res_store, 0);
+
+#define ADXL345_FORMAT_ATTRS						\
+	&iio_const_attr_sampling_frequency_available.dev_attr.attr,	\
+	&iio_const_attr_in_accel_range_available.dev_attr.attr,		\
+	&iio_dev_attr_in_accel_scale_available.dev_attr.attr,		\
+	&iio_dev_attr_in_accel_range.dev_attr.attr,			\
+	&iio_dev_attr_in_accel_full_resolution.dev_attr.attr,		\
+	&iio_dev_attr_filter_decimation.dev_attr.attr,			\
+	&iio_dev_attr_filter_order.dev_attr.attr
+
+static struct attribute *adxl345_attrs[] = {
+	ADXL345_FORMAT_ATTRS,
+	NULL,
+};
+
+static const struct attribute_group adxl345_group = {
+	.attrs = adxl345_attrs,
+};
+
+static const struct iio_info adxl345_info = {
+	.driver_module	= THIS_MODULE,
+	.read_raw	= adxl345_read_raw,
+	.write_raw	= adxl345_write_raw,
+	.attrs		= &adxl345_group,
+};
+
+static irqreturn_t adxl345_trigger_handler(int irq, void *p)
+{
+	struct iio_poll_func *pf = p;
+	struct iio_dev *indio_dev = pf->indio_dev;
+	struct adxl345_prv *st = iio_priv(indio_dev);
+	s64 ts = pf->timestamp;
+	s16 xyz[3];
+	int ret, i;
+
+	/* Chained from our own IRQ thread : the edge time was taken in hard IRQ */
+	if (indio_dev->trig == st->dready_trig)
+		ts = ktime_to_ns(st->irq_ts);
+
+	/* Decimated outputs carry the time of the last input sample */
+	ret = adxl345_read_xyz(st, xyz);
+	if (!ret && adxl345_filter(st, xyz)) {
+		for (i = 0; i < 3; i++)
+			st->scan.axes[i] = cpu_to_le16(xyz[i]);
+		iio_push_to_buffers_with_timestamp(indio_dev, &st->scan, ts);
+	}
+
+	iio_trigger_notify_done(indio_dev->trig);
+	return IRQ_HANDLED;
+}
+
+static int adxl345_buffer_preenable(struct iio_dev *indio_dev)
+{
+	struct adxl345_prv *st = iio_priv(indio_dev);
+
+	if (test_bit(0, &st->stream_busy))
+		return -EBUSY;
+	adxl345_filter_reset(st);
+	return 0;
+}
+
+static const struct iio_buffer_setup_ops adxl345_buffer_ops = {
+	.preenable	= adxl345_buffer_preenable,
+	.postenable	= iio_triggered_buffer_postenable,
+	.predisable	= iio_triggered_buffer_predisable,
+};
+
+static int adxl345_dready_set_state(struct iio_trigger *trig, bool state)
+{
+	struct iio_dev *indio_dev = iio_trigger_get_drvdata(trig);
+	struct adxl345_prv *st = iio_priv(indio_dev);
+	int ret;
+
+	st->dready_on = state;
+	ret = regmap_update_bits(st->regmap, INT_MAP, INT_DATA_READY, 0);
+	if (!ret)
+		ret = regmap_update_bits(st->regmap, INT_ENABLE, INT_DATA_READY,
+					 state ? INT_DATA_READY : 0);
+	/* Clear a sample that is already pending so the line can toggle */
+	if (!ret && state)
+		ret = regmap_bulk_read(st->regmap, DATAX0, st->scan.axes,
+				       sizeof(st->scan.axes));
+	return ret;
+}
+
+static const struct iio_trigger_ops adxl345_dready_ops = {
+	.owner		  = THIS_MODULE,
+	.set_trigger_state = adxl345_dready_set_state,
+};
+
+static enum hrtimer_restart adxl345_hrtimer_fn(struct hrtimer *timer)
+{
+	struct adxl345_prv *st = container_of(timer, struct adxl345_prv, timer);
+
+	hrtimer_forward_now(timer, st->period);
+	iio_trigger_poll(st->hrtimer_trig);
+	return HRTIMER_RESTART;
+}
+
+/* The hrtimer trigger fires at the output data rate programmed in BW_RATE */
+static int adxl345_hrtimer_set_state(struct iio_trigger *trig, bool state)
+{
+	struct iio_dev *indio_dev = iio_trigger_get_drvdata(trig);
+	struct adxl345_prv *st = iio_priv(indio_dev);
+
+	if (!state) {
+		hrtimer_cancel(&st->timer);
+		return 0;
+	}
+	hrtimer_start(&st->timer, st->period, HRTIMER_MODE_REL);
+	return 0;
+}
+
+static const struct iio_trigger_ops adxl345_hrtimer_ops = {
+	.owner		  = THIS_MODULE,
+	.set_trigger_state = adxl345_hrtimer_set_state,
+};
+
+/*
+ * Motion events
+ *
+ * The activity, inactivity, free-fall and tap engines run inside the chip
+ * and raise INT1 only when something happens, so userspace can sleep in
+ * read() on the IIO event fd instead of polling the data registers.
+ */
+enum adxl345_ev {
+	ADXL345_EV_ACT,
+	ADXL345_EV_INACT,
+	ADXL345_EV_TAP,
+	ADXL345_EV_DTAP,
+	ADXL345_EV_FF,
+};
+
+/* Axis bits as laid out in ACT_INACT_CTL, TAP_AXES and ACT_TAP_STATUS */
+#define ADXL345_AXIS_X		(1 << 2)
+#define ADXL345_AXIS_Y		(1 << 1)
+#define ADXL345_AXIS_Z		(1 << 0)
+#define ADXL345_AXIS_ALL	0x07
+
+/* 62.5 mg/LSB for every threshold register, in u(m/s^2) */
+#define ADXL345_THRESH_USCALE	612916
+
+static const struct {
+	u8 thresh;
+	u8 time;		/* 0 : no period */
+	unsigned int time_us;	/* per LSB */
+	u8 int_bit;
+} adxl345_ev_regs[] = {
+	[ADXL345_EV_ACT]   = { THRESH_ACT,   0,          0,       INT_ACTIVITY },
+	[ADXL345_EV_INACT] = { THRESH_INACT, TIME_INACT, 1000000, INT_INACTIVITY },
+	[ADXL345_EV_TAP]   = { THRESH_TAP,   DUR,        625,     INT_SINGLE_TAP },
+	[ADXL345_EV_DTAP]  = { THRESH_TAP,   WINDOW,     1250,    INT_DOUBLE_TAP },
+	[ADXL345_EV_FF]    = { THRESH_FF,    TIME_FF,    5000,    INT_FREE_FALL },
+};
+
+/* Datasheet starting points : 3 g / 10 ms taps, 1 g activity, 0.5 g / 100 ms free-fall */
+static const struct reg_sequence adxl345_ev_defaults[] = {
+	{ THRESH_TAP,	0x30 },
+	{ DUR,		0x10 },
+	{ LATENT,	0x10 },
+	{ WINDOW,	0x40 },
+	{ THRESH_ACT,	0x10 },
+	{ THRESH_INACT,	0x04 },
+	{ TIME_INACT,	0x05 },
+	{ ACT_INACT_CTL, 0x00 },
+	{ THRESH_FF,	0x08 },
+	{ TIME_FF,	0x14 },
+	{ TAP_AXES,	0x00 },
+};
+
+static int adxl345_ev_kind(const struct iio_chan_spec *chan,
+			   enum iio_event_type type,
+			   enum iio_event_direction dir)
+{
+	switch (type) {
+	case IIO_EV_TYPE_THRESH:
+		return dir == IIO_EV_DIR_RISING ? ADXL345_EV_ACT : ADXL345_EV_INACT;
+	case IIO_EV_TYPE_MAG:
+		return dir == IIO_EV_DIR_RISING ? ADXL345_EV_TAP : ADXL345_EV_FF;
+	case IIO_EV_TYPE_MAG_ADAPTIVE:
+		return ADXL345_EV_DTAP;
+	default:
+		return -EINVAL;
+	}
+}
+
+static u8 adxl345_ev_axis(const struct iio_chan_spec *chan)
+{
+	switch (chan->channel2) {
+	case IIO_MOD_X:
+		return ADXL345_AXIS_X;
+	case IIO_MOD_Y:
+		return ADXL345_AXIS_Y;
+	case IIO_MOD_Z:
+		return ADXL345_AXIS_Z;
+	default:
+		return ADXL345_AXIS_ALL;
+	}
+}
+
+/*
+ * Push ev_axes out to the chip. Single and double tap share TAP_AXES, so
+ * the union is enabled there and adxl345_push_motion() filters per kind.
+ * Called with st->lock held.
+ */
+static int adxl345_ev_update(struct adxl345_prv *st)
+{
+	unsigned int ints = 0;
+	int ret, i;
+
+	for (i = 0; i < ARRAY_SIZE(adxl345_ev_regs); i++)
+		if (st->ev_axes[i])
+			ints |= adxl345_ev_regs[i].int_bit;
+
+	ret = regmap_write(st->regmap, ACT_INACT_CTL,
+			   st->ev_axes[ADXL345_EV_ACT] << 4 |
+			   st->ev_axes[ADXL345_EV_INACT]);
+	if (!ret)
+		ret = regmap_write(st->regmap, TAP_AXES,
+				   st->ev_axes[ADXL345_EV_TAP] |
+				   st->ev_axes[ADXL345_EV_DTAP]);
+	if (!ret)
+		ret = regmap_update_bits(st->regmap, INT_MAP, INT_MOTION, 0);
+	if (!ret)
+		ret = regmap_update_bits(st->regmap, INT_ENABLE, INT_MOTION, ints);
+	return ret;
+}
+
+static int adxl345_read_event_config(struct iio_dev *indio_dev,
+				     const struct iio_chan_spec *chan,
+				     enum iio_event_type type,
+				     enum iio_event_direction dir)
+{
+	struct adxl345_prv *st = iio_priv(indio_dev);
+	int kind = adxl345_ev_kind(chan, type, dir);
+
+	if (kind < 0)
+		return kind;
+	return !!(st->ev_axes[kind] & adxl345_ev_axis(chan));
+}
+
+static int adxl345_write_event_config(struct iio_dev *indio_dev,
+				      const struct iio_chan_spec *chan,
+				      enum iio_event_type type,
+				      enum iio_event_direction dir, int state)
+{
+	struct adxl345_prv *st = iio_priv(indio_dev);
+	int kind = adxl345_ev_kind(chan, type, dir);
+	u8 old;
+	int ret;
+
+	if (kind < 0)
+		return kind;
+	mutex_lock(&st->lock);
+	old = st->ev_axes[kind];
+	if (state)
+		st->ev_axes[kind] |= adxl345_ev_axis(chan);
+	else
+		st->ev_axes[kind] &= ~adxl345_ev_axis(chan);
+	ret = adxl345_ev_update(st);
+	if (ret)
+		st->ev_axes[kind] = old;
+	mutex_unlock(&st->lock);
+	return ret;
+}
+
+static int adxl345_read_event_value(struct iio_dev *indio_dev,
+				    const struct iio_chan_spec *chan,
+				    enum iio_event_type type,
+				    enum iio_event_direction dir,
+				    enum iio_event_info info,
+				    int *val, int *val2)
+{
+	struct adxl345_prv *st = iio_priv(indio_dev);
+	int kind = adxl345_ev_kind(chan, type, dir);
+	unsigned int reg, us;
+	int ret;
+
+	if (kind < 0)
+		return kind;
+	switch (info) {
+	case IIO_EV_INFO_VALUE:
+		ret = regmap_read(st->regmap, adxl345_ev_regs[kind].thresh, &reg);
+		if (ret)
+			return ret;
+		*val = div_u64_rem((u64)reg * ADXL345_THRESH_USCALE, 1000000,
+				   (u32 *)val2);
+		return IIO_VAL_INT_PLUS_MICRO;
+	case IIO_EV_INFO_PERIOD:
+		if (!adxl345_ev_regs[kind].time)
+			return -EINVAL;
+		ret = regmap_read(st->regmap, adxl345_ev_regs[kind].time, &reg);
+		if (ret)
+			return ret;
+		us = reg * adxl345_ev_regs[kind].time_us;
+		*val = us / 1000000;
+		*val2 = us % 1000000;
+		return IIO_VAL_INT_PLUS_MICRO;
+	default:
+		return -EINVAL;
+	}
+}
+
+static int adxl345_write_event_value(struct iio_dev *indio_dev,
+				     const struct iio_chan_spec *chan,
+				     enum iio_event_type type,
+				     enum iio_event_direction dir,
+				     enum iio_event_info info,
+				     int val, int val2)
+{
+	struct adxl345_prv *st = iio_priv(indio_dev);
+	int kind = adxl345_ev_kind(chan, type, dir);
+	u64 micro;
+	u8 reg;
+
+	if (kind < 0)
+		return kind;
+	if (val < 0 || val2 < 0)
+		return -EINVAL;
+	micro = (u64)val * 1000000 + val2;
+
+	/* Registers are 8 bit : round to the nearest step and saturate */
+	switch (info) {
+	case IIO_EV_INFO_VALUE:
+		micro = div_u64(micro + ADXL345_THRESH_USCALE / 2,
+				ADXL345_THRESH_USCALE);
+		reg = adxl345_ev_regs[kind].thresh;
+		break;
+	case IIO_EV_INFO_PERIOD:
+		if (!adxl345_ev_regs[kind].time)
+			return -EINVAL;
+		micro = div_u64(micro + adxl345_ev_regs[kind].time_us / 2,
+				adxl345_ev_regs[kind].time_us);
+		reg = adxl345_ev_regs[kind].time;
+		break;
+	default:
+		return -EINVAL;
+	}
+	return regmap_write(st->regmap, reg, min_t(u64, micro, 0xFF));
+}
+
+/* LATENT has no iio_event_info slot : wait after the first tap, in seconds */
+static ssize_t adxl345_tap_latency_show(struct device *dev,
+					struct device_attribute *attr,
+					char *buf)
+{
+	struct adxl345_prv *st = iio_priv(dev_to_iio_dev(dev));
+	unsigned int reg;
+	int ret;
+
+	ret = regmap_read(st->regmap, LATENT, &reg);
+	if (ret)
+		return ret;
+	return sprintf(buf, "0.%06u\n", reg * 1250);
+}
+static ssize_t adxl345_tap_latency_store(struct device *dev,
+					 struct device_attribute *attr,
+					 const char *buf, size_t count)
+{
+	struct adxl345_prv *st = iio_priv(dev_to_iio_dev(dev));
+	int val, val2, ret;
+
+	ret = iio_str_to_fixpoint(buf, 100000, &val, &val2);
+	if (ret)
+		return ret;
+	if (val < 0 || val2 < 0 || val > 0)
+		return -EINVAL;
+	ret = regmap_write(st->regmap, LATENT,
+			   min((val2 + 625) / 1250, 0xFF));
+	return ret ? ret : count;
+}
+
+static IIO_DEVICE_ATTR(in_accel_mag_adaptive_rising_latency, 0644,
+		       adxl345_tap_latency_show, adxl345_tap_latency_store, 0);
+
+static struct attribute *adxl345_event_attrs[] = {
+	&iio_dev_attr_in_accel_mag_adaptive_rising_latency.dev_attr.attr,
+	NULL,
+};
+
+static const struct attribute_group adxl345_event_group = {
+	.attrs = adxl345_event_attrs,
+};
+
+static void adxl345_push_axes(struct iio_dev *indio_dev, u8 axes,
+			      enum iio_event_type type,
+			      enum iio_event_direction dir, s64 ts)
+{
+	if (axes & ADXL345_AXIS_X)
+		iio_push_event(indio_dev, IIO_MOD_EVENT_CODE(IIO_ACCEL, 0,
+				IIO_MOD_X, type, dir), ts);
+	if (axes & ADXL345_AXIS_Y)
+		iio_push_event(indio_dev, IIO_MOD_EVENT_CODE(IIO_ACCEL, 0,
+				IIO_MOD_Y, type, dir), ts);
+	if (axes & ADXL345_AXIS_Z)
+		iio_push_event(indio_dev, IIO_MOD_EVENT_CODE(IIO_ACCEL, 0,
+				IIO_MOD_Z, type, dir), ts);
+}
+
+/*
+ * INT_SOURCE motion bits to IIO events. ACT_TAP_STATUS names the axis that
+ * fired activity or a tap; inactivity means every enabled axis went quiet.
+ */
+static void adxl345_push_motion(struct iio_dev *indio_dev, unsigned int src)
+{
+	struct adxl345_prv *st = iio_priv(indio_dev);
+	s64 ts = ktime_to_ns(st->irq_ts);
+	unsigned int status = 0;
+
+	if (src & (INT_ACTIVITY | INT_SINGLE_TAP | INT_DOUBLE_TAP))
+		regmap_read(st->regmap, ACT_TAP_STATUS, &status);
+
+	if (src & INT_ACTIVITY)
+		adxl345_push_axes(indio_dev,
+				  (status >> 4) & st->ev_axes[ADXL345_EV_ACT],
+				  IIO_EV_TYPE_THRESH, IIO_EV_DIR_RISING, ts);
+	if (src & INT_INACTIVITY)
+		adxl345_push_axes(indio_dev, st->ev_axes[ADXL345_EV_INACT],
+				  IIO_EV_TYPE_THRESH, IIO_EV_DIR_FALLING, ts);
+	if (src & INT_SINGLE_TAP)
+		adxl345_push_axes(indio_dev,
+				  status & st->ev_axes[ADXL345_EV_TAP],
+				  IIO_EV_TYPE_MAG, IIO_EV_DIR_RISING, ts);
+	if (src & INT_DOUBLE_TAP)
+		adxl345_push_axes(indio_dev,
+				  status & st->ev_axes[ADXL345_EV_DTAP],
+				  IIO_EV_TYPE_MAG_ADAPTIVE, IIO_EV_DIR_RISING,
+				  ts);
+	if (src & INT_FREE_FALL)
+		iio_push_event(indio_dev, IIO_MOD_EVENT_CODE(IIO_ACCEL, 0,
+				IIO_MOD_X_AND_Y_AND_Z, IIO_EV_TYPE_MAG,
+				IIO_EV_DIR_FALLING), ts);
+}
+
+/*
+ * FIFO streaming
+ *
+ * While /dev/adxl345_stream<N> is open the FIFO runs in stream mode and raises
+ * the watermark interrupt on INT1 once fifo_watermark samples are queued.
+ * The threaded handler drains the FIFO (one 6 byte burst per entry, the
+ * FIFO pops on each read of DATAZ1) into a kfifo of timestamped samples;
+ * read() hands out as many whole samples as fit and poll() reports POLLIN
+ * when at least one is queued. Streaming and the IIO buffer exclude each
+ * other since both consume the data registers.
+ */
+static irqreturn_t adxl345_irq_hard(int irq, void *dev_id)
+{
+	struct iio_dev *indio_dev = dev_id;
+	struct adxl345_prv *st = iio_priv(indio_dev);
+
+	/* Taken as close to the edge as possible, used to timestamp the batch */
+	st->irq_ts = ktime_get();
+	if (READ_ONCE(st->fast_on))
+		return st->fast->irq(st->fast->priv, ktime_to_ns(st->irq_ts));
+	return IRQ_WAKE_THREAD;
+}
+
+/*
+ * Records queued in the ring. tail is the one value taken from the mapping :
+ * a reader writing garbage there only makes its own ring look full.
+ */
+static unsigned int adxl345_ring_avail(struct adxl345_prv *st)
+{
+	/* Pairs with the reader's release store of tail */
+	u32 used = st->ring_head - smp_load_acquire(&st->ring_ctl->tail);
+
+	return min(used, st->ring_mask + 1);
+}
+
+/* Filter one FIFO entry and queue it for readers; true if it was queued */
+static bool adxl345_queue_sample(struct adxl345_prv *st, s16 xyz[3], s64 ts)
+{
+	struct adxl345_sample s;
+	u32 head;
+
+	if (!adxl345_filter(st, xyz))
+		return false;
+	if (st->ring) {
+		head = st->ring_head;
+		if (adxl345_ring_avail(st) > st->ring_mask) {
+			WRITE_ONCE(st->ring->dropped, ++st->ring_dropped);
+			st->dropped++;
+			return false;
+		}
+		s = (struct adxl345_sample){ ts, xyz[0], xyz[1], xyz[2], 0 };
+		st->ring_data[head & st->ring_mask] = s;
+		st->ring_head = head + 1;
+		smp_store_release(&st->ring->head, st->ring_head);
+		return true;
+	}
+	s.timestamp = ts;
+	s.x = xyz[0];
+	s.y = xyz[1];
+	s.z = xyz[2];
+	s.pad = 0;
+	if (kfifo_put(&st->fifo, s))
+		return true;
+	st->dropped++;
+	return false;
+}
+
+/* kfifo readers want any sample, ring readers only ring_watermark of them */
+static void adxl345_wake_readers(struct adxl345_prv *st, unsigned int queued)
+{
+	if (!queued)
+		return;
+	if (st->ring && adxl345_ring_avail(st) < READ_ONCE(st->ring_watermark))
+		return;
+	wake_up_interruptible(&st->wait);
+}
+
+static void adxl345_fifo_drain(struct adxl345_prv *st)
+{
+	unsigned int entries, n, i, queued = 0;
+	s16 xyz[ADXL345_FIFO_MAX][3];
+	unsigned long flags;
+	s64 ts;
+
+	if (regmap_read(st->regmap, FIFO_STATUS, &entries))
+		return;
+	entries = min_t(unsigned int, entries & FIFO_ENTRIES_MASK,
+			ADXL345_FIFO_MAX);
+	/* Read with the bus, queue under the push lock */
+	for (n = 0; n < entries; n++)
+		if (adxl345_read_xyz(st, xyz[n]))
+			break;
+
+	/* irq_ts is when the watermark'th sample landed, the rest are one ODR period apart */
+	ts = ktime_to_ns(st->irq_ts) - (s64)(st->watermark - 1) * st->period_ns;
+	spin_lock_irqsave(&st->push_lock, flags);
+	for (i = 0; i < n; i++)
+		queued += adxl345_queue_sample(st, xyz[i],
+					       ts + (s64)i * st->period_ns);
+	/* With decimation most drains produce nothing : don't wake readers */
+	adxl345_wake_readers(st, queued);
+	spin_unlock_irqrestore(&st->push_lock, flags);
+}
+
+static irqreturn_t adxl345_irq_thread(int irq, void *dev_id)
+{
+	struct iio_dev *indio_dev = dev_id;
+	struct adxl345_prv *st = iio_priv(indio_dev);
+	irqreturn_t ret = IRQ_NONE;
+	unsigned int src;
+
+	if (regmap_read(st->regmap, INT_SOURCE, &src))
+		return IRQ_NONE;
+	if ((src & INT_DATA_READY) && st->dready_on) {
+		iio_trigger_poll_chained(st->dready_trig);
+		ret = IRQ_HANDLED;
+	}
+	if (src & INT_MOTION) {
+		adxl345_push_motion(indio_dev, src);
+		ret = IRQ_HANDLED;
+	}
+	if (src & INT_OVERRUN)
+		st->overruns++;
+	if ((src & (INT_WATERMARK | INT_OVERRUN)) &&
+	    test_bit(0, &st->stream_busy)) {
+		adxl345_fifo_drain(st);
+		ret = IRQ_HANDLED;
+	}
+	return ret;
+}
+
+/* Motion bits seen by the fast path : ACT_TAP_STATUS needs a sleeping read */
+static void adxl345_motion_work(struct work_struct *work)
+{
+	struct adxl345_prv *st = container_of(work, struct adxl345_prv,
+					      motion_work);
+	unsigned int src;
+
+	spin_lock_irq(&st->motion_lock);
+	src = st->motion_src;
+	st->motion_src = 0;
+	spin_unlock_irq(&st->motion_lock);
+	if (src)
+		adxl345_push_motion(iio_priv_to_dev(st), src);
+}
+
+/**
+ * adxl345_core_push() - hand a FIFO batch read by the fast path to the core
+ * @dev:	device passed to adxl345_core_probe()
+ * @int_source:	INT_SOURCE as read ahead of the batch
+ * @xyz:	@n entries, oldest first
+ * @timestamp:	hard IRQ time of the INT1 edge that started the read
+ *
+ * Callable from the SPI completion, i.e. atomic context. Batches are queued
+ * under push_lock, so a fallback drain by the IRQ thread may overlap them.
+ */
+void adxl345_core_push(struct device *dev, unsigned int int_source,
+		       s16 (*xyz)[3], unsigned int n, s64 timestamp)
+{
+	struct adxl345_prv *st = iio_priv((struct iio_dev *)dev_get_drvdata(dev));
+	unsigned int i, queued = 0;
+	unsigned long flags;
+	s64 ts;
+
+	if (int_source & INT_OVERRUN)
+		st->overruns++;
+	if (int_source & INT_MOTION) {
+		spin_lock_irqsave(&st->motion_lock, flags);
+		st->motion_src |= int_source & INT_MOTION;
+		spin_unlock_irqrestore(&st->motion_lock, flags);
+		schedule_work(&st->motion_work);
+	}
+
+	ts = timestamp - (s64)(st->watermark - 1) * st->period_ns;
+	spin_lock_irqsave(&st->push_lock, flags);
+	for (i = 0; i < n; i++)
+		queued += adxl345_queue_sample(st, xyz[i],
+					       ts + (s64)i * st->period_ns);
+	adxl345_wake_readers(st, queued);
+	spin_unlock_irqrestore(&st->push_lock, flags);
+}
+EXPORT_SYMBOL_GPL(adxl345_core_push);
+
+static int adxl345_stream_start(struct adxl345_prv *st)
+{
+	int ret;
+
+	kfifo_reset(&st->fifo);
+	adxl345_filter_reset(st);
+	/* Bypass first to flush stale entries, then stream with the watermark */
+	ret = regmap_write(st->regmap, FIFO_CTL, 0);
+	if (!ret)
+		ret = regmap_write(st->regmap, FIFO_CTL,
+				   FIFO_MODE_STREAM | st->watermark);
+	/* From here on INT1 belongs to the bus fast path, if there is one */
+	if (!ret && st->fast) {
+		ret = st->fast->start(st->fast->priv, st->watermark);
+		if (!ret)
+			WRITE_ONCE(st->fast_on, true);
+	}
+	if (!ret)
+		ret = regmap_update_bits(st->regmap, INT_MAP,
+					 INT_WATERMARK | INT_OVERRUN, 0);
+	if (!ret)
+		ret = regmap_update_bits(st->regmap, INT_ENABLE,
+					 INT_WATERMARK | INT_OVERRUN,
+					 INT_WATERMARK | INT_OVERRUN);
+	return ret;
+}
+
+static void adxl345_stream_stop(struct adxl345_prv *st)
+{
+	regmap_update_bits(st->regmap, INT_ENABLE,
+			   INT_WATERMARK | INT_OVERRUN, 0);
+	regmap_write(st->regmap, FIFO_CTL, 0);
+	if (st->fast_on) {
+		WRITE_ONCE(st->fast_on, false);
+		synchronize_irq(st->irq);
+		st->fast->stop(st->fast->priv);
+	}
+}
+
+/* Header page, control page, records; see adxl345_ring.h */
+#define ADXL345_RING_CTL_PGOFF	1
+#define ADXL345_RING_DATA	(2 * PAGE_SIZE)
+
+static int adxl345_ring_alloc(struct adxl345_prv *st, unsigned int size)
+{
+	struct adxl345_ring_hdr *ring;
+	size_t map_size = PAGE_ALIGN(ADXL345_RING_DATA +
+				     size * sizeof(struct adxl345_sample));
+
+	/* Zeroed, page aligned and allowed into remap_vmalloc_range() */
+	ring = vmalloc_user(map_size);
+	if (!ring)
+		return -ENOMEM;
+	ring->magic = ADXL345_RING_MAGIC;
+	ring->version = ADXL345_RING_VERSION;
+	ring->map_size = map_size;
+	ring->data_offset = ADXL345_RING_DATA;
+	ring->ctl_offset = ADXL345_RING_CTL_PGOFF << PAGE_SHIFT;
+	ring->size = size;
+	ring->record_size = sizeof(struct adxl345_sample);
+	st->ring = ring;
+	st->ring_ctl = (void *)ring + ring->ctl_offset;
+	st->ring_data = (void *)ring + ADXL345_RING_DATA;
+	st->ring_head = 0;
+	st->ring_mask = size - 1;
+	st->ring_map_size = map_size;
+	st->ring_dropped = 0;
+	return 0;
+}
+
+/* One consumer at a time : the kfifo reader or the ring, not both */
+static int adxl345_stream_acquire(struct adxl345_prv *st, bool ring)
+{
+	struct iio_dev *indio_dev = iio_priv_to_dev(st);
+	int ret;
+
+	mutex_lock(&st->lock);
+	if (st->dead) {
+		mutex_unlock(&st->lock);
+		return -ENODEV;
+	}
+	if (iio_buffer_enabled(indio_dev) ||
+	    test_and_set_bit(0, &st->stream_busy)) {
+		mutex_unlock(&st->lock);
+		return -EBUSY;
+	}
+	if (ring) {
+		ret = adxl345_ring_alloc(st, st->ring_size);
+		if (ret) {
+			clear_bit(0, &st->stream_busy);
+			mutex_unlock(&st->lock);
+			return ret;
+		}
+	}
+	ret = adxl345_stream_start(st);
+	if (ret) {
+		adxl345_stream_stop(st);
+		vfree(st->ring);
+		st->ring = NULL;
+		clear_bit(0, &st->stream_busy);
+	} else {
+		kref_get(&st->ref);
+	}
+	mutex_unlock(&st->lock);
+	return ret;
+}
+
+/* Open files outlive adxl345_core_remove(), the last one frees the device */
+static void adxl345_release_prv(struct kref *ref)
+{
+	struct adxl345_prv *st = container_of(ref, struct adxl345_prv, ref);
+
+	iio_device_free(iio_priv_to_dev(st));
+}
+
+static int adxl345_stream_put(struct inode *inode, struct file *filp)
+{
+	struct adxl345_prv *st = filp->private_data;
+
+	mutex_lock(&st->lock);
+	/* After remove the hardware is stopped and the regmap may be gone */
+	if (!st->dead)
+		adxl345_stream_stop(st);
+	/* Last mapping is gone too, it holds a reference on filp */
+	vfree(st->ring);
+	st->ring = NULL;
+	clear_bit(0, &st->stream_busy);
+	mutex_unlock(&st->lock);
+	kref_put(&st->ref, adxl345_release_prv);
+	return 0;
+}
+
+static int adxl345_stream_open(struct inode *inode, struct file *filp)
+{
+	struct adxl345_prv *st = container_of(inode->i_cdev,
+					      struct adxl345_prv, cdev);
+	int ret;
+
+	ret = adxl345_stream_acquire(st, false);
+	if (ret)
+		return ret;
+	filp->private_data = st;
+	return nonseekable_open(inode, filp);
+}
+
+static ssize_t adxl345_stream_read(struct file *filp, char __user *buf,
+				   size_t count, loff_t *ppos)
+{
+	struct adxl345_prv *st = filp->private_data;
+	unsigned int copied;
+	int ret;
+
+	if (count < sizeof(struct adxl345_sample))
+		return -EINVAL;
+	if (kfifo_is_empty(&st->fifo)) {
+		if (READ_ONCE(st->dead))
+			return -ENODEV;
+		if (filp->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		ret = wait_event_interruptible(st->wait,
+					       !kfifo_is_empty(&st->fifo) ||
+					       READ_ONCE(st->dead));
+		if (ret)
+			return ret;
+		if (READ_ONCE(st->dead))
+			return -ENODEV;
+	}
+	if (mutex_lock_interruptible(&st->read_lock))
+		return -ERESTARTSYS;
+	ret = kfifo_to_user(&st->fifo, buf, count, &copied);
+	mutex_unlock(&st->read_lock);
+
+	return ret ? ret : copied;
+}
+
+static unsigned int adxl345_stream_poll(struct file *filp, poll_table *wait)
+{
+	struct adxl345_prv *st = filp->private_data;
+
+	poll_wait(filp, &st->wait, wait);
+	if (READ_ONCE(st->dead))
+		return POLLERR | POLLHUP;
+	if (!kfifo_is_empty(&st->fifo))
+		return POLLIN | POLLRDNORM;
+	return 0;
+}
+
+static const struct file_operations adxl345_stream_fops = {
+	.owner   = THIS_MODULE,
+	.open    = adxl345_stream_open,
+	.release = adxl345_stream_put,
+	.read    = adxl345_stream_read,
+	.poll    = adxl345_stream_poll,
+	.llseek  = no_llseek,
+};
+
+/*
+ * /dev/adxl345_ring<N> : same acquisition as adxl345_stream<N>, but samples go
+ * into a ring shared with the reader through mmap (layout in
+ * adxl345_ring.h), so there is no copy and no syscall per sample.
+ */
+static int adxl345_ring_open(struct inode *inode, struct file *filp)
+{
+	struct adxl345_prv *st = container_of(inode->i_cdev,
+					      struct adxl345_prv, ring_cdev);
+	int ret;
+
+	ret = adxl345_stream_acquire(st, true);
+	if (ret)
+		return ret;
+	filp->private_data = st;
+	return nonseekable_open(inode, filp);
+}
+
+/* Only the control page may be mapped writable, the rest is driver owned */
+static int adxl345_ring_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	struct adxl345_prv *st = filp->private_data;
+	unsigned long len = vma->vm_end - vma->vm_start;
+	bool ctl;
+
+	if (READ_ONCE(st->dead))
+		return -ENODEV;
+	if (vma->vm_pgoff >= st->ring_map_size >> PAGE_SHIFT ||
+	    len > st->ring_map_size - (vma->vm_pgoff << PAGE_SHIFT))
+		return -EINVAL;
+	ctl = vma->vm_pgoff == ADXL345_RING_CTL_PGOFF && len == PAGE_SIZE;
+	if (!ctl) {
+		if (vma->vm_flags & VM_WRITE)
+			return -EPERM;
+		vma->vm_flags &= ~VM_MAYWRITE;
+	}
+	return remap_vmalloc_range(vma, st->ring, vma->vm_pgoff);
+}
+
+static unsigned int adxl345_ring_poll(struct file *filp, poll_table *wait)
+{
+	struct adxl345_prv *st = filp->private_data;
+
+	poll_wait(filp, &st->wait, wait);
+	if (READ_ONCE(st->dead))
+		return POLLERR | POLLHUP;
+	if (adxl345_ring_avail(st) >= READ_ONCE(st->ring_watermark))
+		return POLLIN | POLLRDNORM;
+	return 0;
+}
+
+static const struct file_operations adxl345_ring_fops = {
+	.owner   = THIS_MODULE,
+	.open    = adxl345_ring_open,
+	.release = adxl345_stream_put,
+	.mmap    = adxl345_ring_mmap,
+	.poll    = adxl345_ring_poll,
+	.llseek  = no_llseek,
+};
+
+static ssize_t fifo_watermark_show(struct device *dev,
+				   struct device_attribute *attr, char *buf)
+{
+	struct adxl345_prv *st = iio_priv(dev_to_iio_dev(dev));
+
+	return sprintf(buf, "%u\n", st->watermark);
+}
+/*
+ * Takes effect on the next open of the stream device. Busy while streaming :
+ * FIFO_CTL still holds the old value and the drain timestamps follow it.
+ */
+static ssize_t fifo_watermark_store(struct device *dev,
+				    struct device_attribute *attr,
+				    const char *buf, size_t count)
+{
+	struct adxl345_prv *st = iio_priv(dev_to_iio_dev(dev));
+	unsigned int val;
+	int ret = 0;
+
+	if (kstrtouint(buf, 0, &val) || val < 1 || val > FIFO_ENTRIES_MAX)
+		return -EINVAL;
+	mutex_lock(&st->lock);
+	if (test_bit(0, &st->stream_busy))
+		ret = -EBUSY;
+	else
+		st->watermark = val;
+	mutex_unlock(&st->lock);
+	return ret ? ret : count;
+}
+static ssize_t fifo_stats_show(struct device *dev,
+			       struct device_attribute *attr, char *buf)
+{
+	struct adxl345_prv *st = iio_priv(dev_to_iio_dev(dev));
+
+	return sprintf(buf, "queued %u dropped %lu overruns %lu\n",
+		       kfifo_len(&st->fifo), st->dropped, st->overruns);
+}
+
+/*
+ * ring_size : records, power of 2, next open. ring_watermark : POLLIN level,
+ * kept below both the next and the open ring size or poll() never fires.
+ * Both under st->lock, as the open that consumes them.
+ */
+static ssize_t ring_size_show(struct device *dev,
+			      struct device_attribute *attr, char *buf)
+{
+	struct adxl345_prv *st = iio_priv(dev_to_iio_dev(dev));
+
+	return sprintf(buf, "%u\n", st->ring_size);
+}
+static ssize_t ring_size_store(struct device *dev,
+			       struct device_attribute *attr,
+			       const char *buf, size_t count)
+{
+	struct adxl345_prv *st = iio_priv(dev_to_iio_dev(dev));
+	unsigned int val;
+
+	if (kstrtouint(buf, 0, &val) || !is_power_of_2(val) ||
+	    val < ADXL345_RING_MIN || val > ADXL345_RING_MAX)
+		return -EINVAL;
+	mutex_lock(&st->lock);
+	st->ring_size = val;
+	if (st->ring_watermark >= val)
+		WRITE_ONCE(st->ring_watermark, val - 1);
+	mutex_unlock(&st->lock);
+	return count;
+}
+static ssize_t ring_watermark_show(struct device *dev,
+				   struct device_attribute *attr, char *buf)
+{
+	struct adxl345_prv *st = iio_priv(dev_to_iio_dev(dev));
+
+	return sprintf(buf, "%u\n", st->ring_watermark);
+}
+static ssize_t ring_watermark_store(struct device *dev,
+				    struct device_attribute *attr,
+				    const char *buf, size_t count)
+{
+	struct adxl345_prv *st = iio_priv(dev_to_iio_dev(dev));
+	unsigned int val;
+
+	if (kstrtouint(buf, 0, &val) || val < 1 || val > ADXL345_RING_MAX)
+		return -EINVAL;
+	mutex_lock(&st->lock);
+	val = min(val, st->ring_size - 1);
+	if (st->ring)
+		val = min(val, st->ring_mask);
+	WRITE_ONCE(st->ring_watermark, val);
+	mutex_unlock(&st->lock);
+	return count;
+}
+
+static DEVICE_ATTR(fifo_watermark, 0644, fifo_watermark_show, fifo_watermark_store);
+static DEVICE_ATTR(ring_size, 0644, ring_size_show, ring_size_store);
+static DEVICE_ATTR(ring_watermark, 0644, ring_watermark_show, ring_watermark_store);
+static DEVICE_ATTR(fifo_stats, 0444, fifo_stats_show, NULL);
+
+/* N of /dev/adxl345_stream<N> and /dev/adxl345_ring<N> for this sensor */
+static ssize_t stream_index_show(struct device *dev,
+				 struct device_attribute *attr, char *buf)
+{
+	struct adxl345_prv *st = iio_priv(dev_to_iio_dev(dev));
+
+	return sprintf(buf, "%d\n", st->index);
+}
+static DEVICE_ATTR(stream_index, 0444, stream_index_show, NULL);
+
+static struct attribute *adxl345_stream_attrs[] = {
+	ADXL345_FORMAT_ATTRS,
+	&dev_attr_fifo_watermark.attr,
+	&dev_attr_fifo_stats.attr,
+	&dev_attr_stream_index.attr,
+	&dev_attr_ring_size.attr,
+	&dev_attr_ring_watermark.attr,
+	NULL,
+};
+
+static const struct attribute_group adxl345_stream_group = {
+	.attrs = adxl345_stream_attrs,
+};
+
+static const struct iio_info adxl345_stream_info = {
+	.driver_module	= THIS_MODULE,
+	.read_raw	= adxl345_read_raw,
+	.write_raw	= adxl345_write_raw,
+	.attrs		= &adxl345_stream_group,
+	.event_attrs	= &adxl345_event_group,
+	.read_event_config  = adxl345_read_event_config,
+	.write_event_config = adxl345_write_event_config,
+	.read_event_value   = adxl345_read_event_value,
+	.write_event_value  = adxl345_write_event_value,
+};
+
+static int adxl345_stream_init(struct adxl345_prv *st)
+{
+	struct device *dev;
+	int ret;
+
+	st->index = ida_simple_get(&adxl345_ida, 0, ADXL345_STREAM_DEVS,
+				   GFP_KERNEL);
+	if (st->index < 0)
+		return st->index;
+	/* minor 2N : adxl345_stream<N> (read), 2N + 1 : adxl345_ring<N> (mmap) */
+	st->devt = MKDEV(MAJOR(adxl345_devt),
+			 MINOR(adxl345_devt) + 2 * st->index);
+	cdev_init(&st->cdev, &adxl345_stream_fops);
+	st->cdev.owner = THIS_MODULE;
+	ret = cdev_add(&st->cdev, st->devt, 1);
+	if (ret)
+		goto err_ida;
+	cdev_init(&st->ring_cdev, &adxl345_ring_fops);
+	st->ring_cdev.owner = THIS_MODULE;
+	ret = cdev_add(&st->ring_cdev, st->devt + 1, 1);
+	if (ret)
+		goto err_cdev;
+	dev = device_create(adxl345_class, st->dev, st->devt, NULL,
+			    "adxl345_stream%d", st->index);
+	if (IS_ERR(dev)) {
+		ret = PTR_ERR(dev);
+		goto err_ring_cdev;
+	}
+	dev = device_create(adxl345_class, st->dev, st->devt + 1, NULL,
+			    "adxl345_ring%d", st->index);
+	if (IS_ERR(dev)) {
+		ret = PTR_ERR(dev);
+		goto err_dev;
+	}
+	return 0;
+
+err_dev:
+	device_destroy(adxl345_class, st->devt);
+err_ring_cdev:
+	cdev_del(&st->ring_cdev);
+err_cdev:
+	cdev_del(&st->cdev);
+err_ida:
+	ida_simple_remove(&adxl345_ida, st->index);
+	return ret;
+}
+
+static void adxl345_stream_exit(struct adxl345_prv *st)
+{
+	device_destroy(adxl345_class, st->devt + 1);
+	device_destroy(adxl345_class, st->devt);
+	cdev_del(&st->ring_cdev);
+	cdev_del(&st->cdev);
+	ida_simple_remove(&adxl345_ida, st->index);
+}
+
+static struct iio_trigger *adxl345_trigger_new(struct iio_dev *indio_dev,
+					       const char *kind,
+					       const struct iio_trigger_ops *ops)
+{
+	struct iio_trigger *trig;
+	int ret;
+
+	trig = iio_trigger_alloc("%s-%s-dev%d", indio_dev->name, kind,
+				 indio_dev->id);
+	if (!trig)
+		return ERR_PTR(-ENOMEM);
+	trig->dev.parent = indio_dev->dev.parent;
+	trig->ops = ops;
+	iio_trigger_set_drvdata(trig, indio_dev);
+	ret = iio_trigger_register(trig);
+	if (ret) {
+		iio_trigger_free(trig);
+		return ERR_PTR(ret);
+	}
+	return trig;
+}
+
+static void adxl345_trigger_del(struct iio_trigger *trig)
+{
+	if (IS_ERR_OR_NULL(trig))
+		return;
+	iio_trigger_unregister(trig);
+	iio_trigger_free(trig);
+}
+
+//1.BW_RATE	: 100 Hz normal power (0x0A), in_accel_sampling_frequency at runtime
+//2.POWER_CTL	: Measure (0x08)
+//3.DATA_FORMAT: Full resolution, range = +/-2g (0x08), in_accel_range / in_accel_full_resolution at runtime
+
+int adxl345_core_probe(struct device *dev, struct regmap *regmap, int irq,
+		       const char *name, const struct adxl345_fastpath *fast)
+{
+	struct iio_dev *indio_dev;
+	struct adxl345_prv *st;
+	unsigned int devid;
+	int ret, i;
+
+	ret = regmap_read(regmap, DEVID, &devid);
+	if (ret)
+		return ret;
+	/* The Device ID of the ADXL345 is 0xE5, which is 229 in decimal */
+	pr_info("%s: Device %s probed, DEVID %02x......\n", __func__, name, devid);
+
+	indio_dev = iio_device_alloc(sizeof(struct adxl345_prv));
+	if(!indio_dev){
+		pr_info("Requested memory not allocated\n");
+		return -ENOMEM;
+	}
+	st = iio_priv(indio_dev);
+	st->dev = dev;
+	st->regmap = regmap;
+	kref_init(&st->ref);
+	mutex_init(&st->lock);
+	INIT_KFIFO(st->fifo);
+	init_waitqueue_head(&st->wait);
+	mutex_init(&st->read_lock);
+	spin_lock_init(&st->motion_lock);
+	spin_lock_init(&st->push_lock);
+	INIT_WORK(&st->motion_work, adxl345_motion_work);
+	st->fast = fast;
+	st->watermark = 16;
+	st->ring_size = 4096;
+	st->ring_watermark = 64;
+	adxl345_filter_setup(st, 1, 1);
+	for (i = 0; i < 3; i++)
+		st->calibscale[i] = 1 << 16;
+	hrtimer_init(&st->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	st->timer.function = adxl345_hrtimer_fn;
+	dev_set_drvdata(dev, indio_dev);
+
+	/* Known defaults, not whatever bits were left over from the last load */
+	ret = regmap_write(regmap, BW_RATE, BW_RATE_DEFAULT);
+	if (!ret)
+		ret = adxl345_set_rate(st, BW_RATE_DEFAULT);
+	if (!ret)
+		ret = adxl345_set_format(st, 0, true);
+	/* No interrupt source left armed, motion engines at their defaults */
+	if (!ret)
+		ret = regmap_write(regmap, INT_ENABLE, 0);
+	if (!ret)
+		ret = regmap_multi_reg_write(regmap, adxl345_ev_defaults,
+					     ARRAY_SIZE(adxl345_ev_defaults));
+	if (!ret)
+		ret = regmap_update_bits(regmap, POWER_CTL, POWER_CTL_MEASURE,
+					 POWER_CTL_MEASURE);
+	if (ret) {
+		dev_err(dev, "config write failed %d\n", ret);
+		goto err_free;
+	}
+
+	indio_dev->dev.parent = dev;
+	indio_dev->name = name;
+	if (irq > 0) {
+		indio_dev->channels = adxl345_event_channels;
+		indio_dev->num_channels = ARRAY_SIZE(adxl345_event_channels);
+	} else {
+		indio_dev->channels = adxl345_channels;
+		indio_dev->num_channels = ARRAY_SIZE(adxl345_channels);
+	}
+	indio_dev->available_scan_masks = adxl345_scan_masks;
+	indio_dev->modes = INDIO_DIRECT_MODE;
+	indio_dev->info = irq > 0 ? &adxl345_stream_info : &adxl345_info;
+
+	ret = iio_triggered_buffer_setup(indio_dev, iio_pollfunc_store_time,
+					 adxl345_trigger_handler,
+					 &adxl345_buffer_ops);
+	if (ret)
+		goto err_free;
+
+	st->hrtimer_trig = adxl345_trigger_new(indio_dev, "hrtimer",
+					       &adxl345_hrtimer_ops);
+	if (IS_ERR(st->hrtimer_trig)) {
+		ret = PTR_ERR(st->hrtimer_trig);
+		goto err_buffer;
+	}
+
+	/* INT1 wired : data-ready trigger, FIFO streaming and motion events */
+	if (irq > 0) {
+		st->dready_trig = adxl345_trigger_new(indio_dev, "dready",
+						      &adxl345_dready_ops);
+		if (IS_ERR(st->dready_trig)) {
+			ret = PTR_ERR(st->dready_trig);
+			goto err_trig;
+		}
+		ret = request_threaded_irq(irq, adxl345_irq_hard,
+					   adxl345_irq_thread,
+					   IRQF_TRIGGER_HIGH | IRQF_ONESHOT,
+					   name, indio_dev);
+		if (ret)
+			goto err_trig;
+		st->irq = irq;
+		ret = adxl345_stream_init(st);
+		if (ret)
+			goto err_irq;
+	}
+
+	ret = iio_device_register(indio_dev);
+	if (ret)
+		goto err_stream;
+	return 0;
+
+err_stream:
+	if (st->irq)
+		adxl345_stream_exit(st);
+err_irq:
+	if (st->irq)
+		free_irq(st->irq, indio_dev);
+err_trig:
+	adxl345_trigger_del(st->dready_trig);
+	adxl345_trigger_del(st->hrtimer_trig);
+err_buffer:
+	iio_triggered_buffer_cleanup(indio_dev);
+err_free:
+	iio_device_free(indio_dev);
+	return ret;
+}
+EXPORT_SYMBOL_GPL(adxl345_core_probe);
+
+int adxl345_core_remove(struct device *dev)
+{
+	struct iio_dev *indio_dev = dev_get_drvdata(dev);
+	struct adxl345_prv *st = iio_priv(indio_dev);
+
+	iio_device_unregister(indio_dev);
+	if (st->irq) {
+		/* Fail new opens, stop a running stream, release blocked readers */
+		mutex_lock(&st->lock);
+		st->dead = true;
+		if (test_bit(0, &st->stream_busy))
+			adxl345_stream_stop(st);
+		mutex_unlock(&st->lock);
+		wake_up_interruptible(&st->wait);
+		adxl345_stream_exit(st);
+		free_irq(st->irq, indio_dev);
+		cancel_work_sync(&st->motion_work);
+	}
+	adxl345_trigger_del(st->dready_trig);
+	adxl345_trigger_del(st->hrtimer_trig);
+	hrtimer_cancel(&st->timer);
+	iio_triggered_buffer_cleanup(indio_dev);
+	/* Open stream/ring files keep st until they are closed */
+	kref_put(&st->ref, adxl345_release_prv);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(adxl345_core_remove);
+
+static int __init adxl345_core_init(void)
+{
+	int ret;
+
+	ret = alloc_chrdev_region(&adxl345_devt, 0, 2 * ADXL345_STREAM_DEVS,
+				  "adxl345_stream");
+	if (ret)
+		return ret;
+	adxl345_class = class_create(THIS_MODULE, "adxl345");
+	if (IS_ERR(adxl345_class)) {
+		unregister_chrdev_region(adxl345_devt, 2 * ADXL345_STREAM_DEVS);
+		return PTR_ERR(adxl345_class);
+	}
+	return 0;
+}
+
+static void __exit adxl345_core_exit(void)
+{
+	class_destroy(adxl345_class);
+	unregister_chrdev_region(adxl345_devt, 2 * ADXL345_STREAM_DEVS);
+	ida_destroy(&adxl345_ida);
+}
+
+module_init(adxl345_core_init);
+module_exit(adxl345_core_exit);
+
+MODULE_DESCRIPTION("ADXL345 Digital Accelerometer core");
+MODULE_AUTHOR("Chandan jha <beingchandanjha@gmail.com>");
+MODULE_LICENSE("GPL");
+MODULE_VERSION(".1");
@@ -0,0 +1,510 @@
+//arm-linux-gcc -O2 -mfpu=neon adxl345_fft.c -o adxl345_fft -lm      BeagleBone, NEON kernels
+//gcc -O2 adxl345_fft.c -o adxl345_fft -lm                          x86 test machines, scalar kernels
+//
+// ADXL345 vibration summary : windowed FFT spectra, RMS and peak per axis.
+//
+//   ./adxl345_fft                         live, from /dev/adxl345_stream0
+//   ./adxl345_fft run.bin                 a log written by ./ADXL345
+//   ./ADXL345 ... | ./adxl345_fft -       anything producing adxl345_sample records
+//
+// Input is struct adxl345_sample records (adxl345_ring.h), optionally behind
+// a struct adxl345_log_hdr. Every hop (-o overlap of -n samples) one line
+// per axis is printed:
+//
+//   <time> <axis> fs <Hz> mean <m/s^2> rms <m/s^2> peak <m/s^2> | <Hz> <amp> ... | <band rms> ...
+//
+// rms and peak are of the AC part (mean removed), spectral peaks are sine
+// amplitudes, bands are octave bands up to fs/2 (lowest band reaches down
+// to the first bin). -c writes the same numbers as packed binary instead :
+// struct fft_rec followed by 3 axes x (3 + 2 * peaks + bands) floats.
+//
+// The sample rate is taken from the timestamps of each window, so driver
+// side decimation (filter_decimation) is accounted for automatically.
+// X and Y go through one complex FFT (X real, Y imaginary) and are split
+// afterwards, Z through a second one.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define HAVE_NEON	1
+#endif
+
+#include "adxl345_ring.h"
+
+#define MAX_PEAKS	8
+#define MAX_BANDS	12
+
+struct fft_rec {
+	int64_t timestamp;	// ns, window centre (wall clock with a log header)
+	float fs;		// Hz
+	uint16_t n;		// FFT size
+	uint8_t peaks, bands;
+};
+
+static int fft_n = 1024;
+static int overlap = 50;	// percent
+static int npeaks = 3;
+static int nbands = 6;
+static int compact;
+static double scale = 0.038246;	// m/s^2 per LSB without a log header
+static double rate_hint = 100;	// Hz, only if timestamps are useless
+static int64_t to_wall;		// log header : monotonic -> realtime offset
+
+static float *win, win_sum, win_sq;
+static float *tw_re, *tw_im;	// stage with half size h : [h .. 2h)
+static uint32_t *bitrev;
+static float *re, *im, *ax[3], *pw[3];
+static int16_t *hist[3];
+static int64_t *hist_ts;
+
+// ---------------------------------------------------------------- kernels
+
+static void s16_to_f32(const int16_t *in, float *out, int n, float k)
+{
+	int i = 0;
+#ifdef HAVE_NEON
+	float32x4_t vk = vdupq_n_f32(k);
+
+	for (; i + 8 <= n; i += 8) {
+		int16x8_t v = vld1q_s16(in + i);
+
+		vst1q_f32(out + i, vmulq_f32(vcvtq_f32_s32(
+				vmovl_s16(vget_low_s16(v))), vk));
+		vst1q_f32(out + i + 4, vmulq_f32(vcvtq_f32_s32(
+				vmovl_s16(vget_high_s16(v))), vk));
+	}
+#endif
+	for (; i < n; i++)
+		out[i] = in[i] * k;
+}
+
+static void stats_f32(const float *x, int n, float *mean, float *rms,
+		      float *peak)
+{
+	float sum = 0, sq = 0, mx = x[0], mn = x[0], m, v;
+	int i = 0;
+#ifdef HAVE_NEON
+	float32x4_t vs = vdupq_n_f32(0), vq = vdupq_n_f32(0);
+	float32x4_t vmx = vdupq_n_f32(x[0]), vmn = vmx;
+	float32x2_t t;
+
+	for (; i + 4 <= n; i += 4) {
+		float32x4_t v4 = vld1q_f32(x + i);
+
+		vs = vaddq_f32(vs, v4);
+		vq = vmlaq_f32(vq, v4, v4);
+		vmx = vmaxq_f32(vmx, v4);
+		vmn = vminq_f32(vmn, v4);
+	}
+	t = vadd_f32(vget_low_f32(vs), vget_high_f32(vs));
+	sum = vget_lane_f32(vpadd_f32(t, t), 0);
+	t = vadd_f32(vget_low_f32(vq), vget_high_f32(vq));
+	sq = vget_lane_f32(vpadd_f32(t, t), 0);
+	t = vmax_f32(vget_low_f32(vmx), vget_high_f32(vmx));
+	mx = vget_lane_f32(vpmax_f32(t, t), 0);
+	t = vmin_f32(vget_low_f32(vmn), vget_high_f32(vmn));
+	mn = vget_lane_f32(vpmin_f32(t, t), 0);
+#endif
+	for (; i < n; i++) {
+		sum += x[i];
+		sq += x[i] * x[i];
+		if (x[i] > mx)
+			mx = x[i];
+		if (x[i] < mn)
+			mn = x[i];
+	}
+	m = sum / n;
+	v = sq / n - m * m;
+	*mean = m;
+	*rms = v > 0 ? sqrtf(v) : 0;
+	*peak = mx - m > m - mn ? mx - m : m - mn;
+}
+
+// out = (x - mean) * window
+static void window_f32(const float *x, float *out, int n, float mean)
+{
+	int i = 0;
+#ifdef HAVE_NEON
+	float32x4_t vm = vdupq_n_f32(mean);
+
+	for (; i + 4 <= n; i += 4)
+		vst1q_f32(out + i, vmulq_f32(vsubq_f32(vld1q_f32(x + i), vm),
+					     vld1q_f32(win + i)));
+#endif
+	for (; i < n; i++)
+		out[i] = (x[i] - mean) * win[i];
+}
+
+static void fft_stage(int h, int n)
+{
+	const float *wr = tw_re + h, *wi = tw_im + h;
+	int k, j;
+
+	for (k = 0; k < n; k += 2 * h) {
+		float *ar = re + k, *ai = im + k, *br = ar + h, *bi = ai + h;
+
+		j = 0;
+#ifdef HAVE_NEON
+		for (; j + 4 <= h; j += 4) {
+			float32x4_t vwr = vld1q_f32(wr + j), vwi = vld1q_f32(wi + j);
+			float32x4_t vbr = vld1q_f32(br + j), vbi = vld1q_f32(bi + j);
+			float32x4_t var = vld1q_f32(ar + j), vai = vld1q_f32(ai + j);
+			float32x4_t tr = vmlsq_f32(vmulq_f32(vbr, vwr), vbi, vwi);
+			float32x4_t ti = vmlaq_f32(vmulq_f32(vbr, vwi), vbi, vwr);
+
+			vst1q_f32(br + j, vsubq_f32(var, tr));
+			vst1q_f32(bi + j, vsubq_f32(vai, ti));
+			vst1q_f32(ar + j, vaddq_f32(var, tr));
+			vst1q_f32(ai + j, vaddq_f32(vai, ti));
+		}
+#endif
+		for (; j < h; j++) {
+			float tr = br[j] * wr[j] - bi[j] * wi[j];
+			float ti = br[j] * wi[j] + bi[j] * wr[j];
+
+			br[j] = ar[j] - tr;
+			bi[j] = ai[j] - ti;
+			ar[j] += tr;
+			ai[j] += ti;
+		}
+	}
+}
+
+// In place radix-2 DIT on re[] / im[]
+static void fft(int n)
+{
+	int i, h;
+	float t;
+
+	for (i = 0; i < n; i++) {
+		uint32_t r = bitrev[i];
+
+		if (r > (uint32_t)i) {
+			t = re[i]; re[i] = re[r]; re[r] = t;
+			t = im[i]; im[i] = im[r]; im[r] = t;
+		}
+	}
+	for (h = 1; h < n; h <<= 1)
+		fft_stage(h, n);
+}
+
+static void power_f32(float *p, int n)
+{
+	int i = 0;
+#ifdef HAVE_NEON
+	for (; i + 4 <= n; i += 4) {
+		float32x4_t r = vld1q_f32(re + i), m = vld1q_f32(im + i);
+
+		vst1q_f32(p + i, vmlaq_f32(vmulq_f32(r, r), m, m));
+	}
+#endif
+	for (; i < n; i++)
+		p[i] = re[i] * re[i] + im[i] * im[i];
+}
+
+#ifdef HAVE_NEON
+static inline float32x4_t vrevq(float32x4_t v)
+{
+	v = vrev64q_f32(v);
+	return vcombine_f32(vget_high_f32(v), vget_low_f32(v));
+}
+#endif
+
+/*
+ * C = FFT(x + jy) : X[k] = (C[k] + C*[n-k]) / 2, Y[k] = (C[k] - C*[n-k]) / 2j,
+ * so |X|^2 = ((Cr+Dr)^2 + (Ci-Di)^2) / 4 and |Y|^2 = ((Ci+Di)^2 + (Dr-Cr)^2) / 4
+ * with D = C[n-k]. Bins 0 .. n/2.
+ */
+static void split_power(float *px, float *py, int n)
+{
+	int k = 1;
+
+	px[0] = re[0] * re[0];
+	py[0] = im[0] * im[0];
+#ifdef HAVE_NEON
+	{
+		float32x4_t q = vdupq_n_f32(0.25f);
+
+		for (; k + 4 <= n / 2 + 1; k += 4) {
+			float32x4_t cr = vld1q_f32(re + k), ci = vld1q_f32(im + k);
+			float32x4_t dr = vrevq(vld1q_f32(re + n - k - 3));
+			float32x4_t di = vrevq(vld1q_f32(im + n - k - 3));
+			float32x4_t a = vaddq_f32(cr, dr), b = vsubq_f32(ci, di);
+			float32x4_t c = vaddq_f32(ci, di), d = vsubq_f32(dr, cr);
+
+			vst1q_f32(px + k, vmulq_f32(vmlaq_f32(vmulq_f32(a, a), b, b), q));
+			vst1q_f32(py + k, vmulq_f32(vmlaq_f32(vmulq_f32(c, c), d, d), q));
+		}
+	}
+#endif
+	for (; k <= n / 2; k++) {
+		float cr = re[k], ci = im[k], dr = re[n - k], di = im[n - k];
+
+		px[k] = ((cr + dr) * (cr + dr) + (ci - di) * (ci - di)) * 0.25f;
+		py[k] = ((ci + di) * (ci + di) + (dr - cr) * (dr - cr)) * 0.25f;
+	}
+}
+
+// ---------------------------------------------------------------- analysis
+
+static int setup(int n)
+{
+	int i, h, bits = 0;
+
+	while ((1 << bits) < n)
+		bits++;
+	win = malloc(n * sizeof(float));
+	tw_re = malloc(n * sizeof(float));
+	tw_im = malloc(n * sizeof(float));
+	bitrev = malloc(n * sizeof(uint32_t));
+	re = malloc(n * sizeof(float));
+	im = malloc(n * sizeof(float));
+	hist_ts = malloc(n * sizeof(int64_t));
+	if (!win || !tw_re || !tw_im || !bitrev || !re || !im || !hist_ts)
+		return -1;
+	for (i = 0; i < 3; i++) {
+		ax[i] = malloc(n * sizeof(float));
+		pw[i] = malloc((n / 2 + 1) * sizeof(float));
+		hist[i] = malloc(n * sizeof(int16_t));
+		if (!ax[i] || !pw[i] || !hist[i])
+			return -1;
+	}
+
+	// Hann
+	win_sum = win_sq = 0;
+	for (i = 0; i < n; i++) {
+		win[i] = 0.5f - 0.5f * cosf(2 * M_PI * i / n);
+		win_sum += win[i];
+		win_sq += win[i] * win[i];
+	}
+	for (h = 1; h < n; h <<= 1)
+		for (i = 0; i < h; i++) {
+			tw_re[h + i] = cos(-M_PI * i / h);
+			tw_im[h + i] = sin(-M_PI * i / h);
+		}
+	for (i = 0; i < n; i++) {
+		uint32_t r = 0;
+		int b;
+
+		for (b = 0; b < bits; b++)
+			if (i & (1 << b))
+				r |= 1u << (bits - 1 - b);
+		bitrev[i] = r;
+	}
+	return 0;
+}
+
+struct axis_sum {
+	float mean, rms, peak;
+	float pk_f[MAX_PEAKS], pk_a[MAX_PEAKS];
+	float band[MAX_BANDS];
+};
+
+static void summarize(const float *p, int n, float fs, struct axis_sum *s)
+{
+	int half = n / 2, k, i, b;
+
+	for (i = 0; i < npeaks; i++)
+		s->pk_f[i] = s->pk_a[i] = 0;
+	// Local maxima, kept sorted by amplitude, parabolic bin interpolation
+	for (k = 2; k < half - 1; k++) {
+		float a, bb, c, d, amp;
+
+		if (!(p[k] > p[k - 1] && p[k] >= p[k + 1]))
+			continue;
+		a = sqrtf(p[k - 1]);
+		bb = sqrtf(p[k]);
+		c = sqrtf(p[k + 1]);
+		d = a - 2 * bb + c;
+		d = d != 0 ? 0.5f * (a - c) / d : 0;
+		amp = 2 * (bb - 0.25f * (a - c) * d) / win_sum;
+		for (i = npeaks; i > 0 && s->pk_a[i - 1] < amp; i--)
+			if (i < npeaks) {
+				s->pk_a[i] = s->pk_a[i - 1];
+				s->pk_f[i] = s->pk_f[i - 1];
+			}
+		if (i < npeaks) {
+			s->pk_a[i] = amp;
+			s->pk_f[i] = (k + d) * fs / n;
+		}
+	}
+	// Octave bands, top one ends at fs/2
+	for (b = 0; b < nbands; b++) {
+		int lo = b ? half >> (nbands - b) : 1;
+		int hi = half >> (nbands - 1 - b);
+		float sum = 0;
+
+		for (k = lo; k < hi || (b == nbands - 1 && k == hi); k++)
+			sum += p[k];
+		s->band[b] = sqrtf(2 * sum / (n * win_sq));
+	}
+}
+
+static void emit(int64_t ts, float fs, struct axis_sum *s)
+{
+	int a, i;
+
+	if (compact) {
+		struct fft_rec r = { ts, fs, fft_n, npeaks, nbands };
+
+		fwrite(&r, sizeof(r), 1, stdout);
+		for (a = 0; a < 3; a++) {
+			fwrite(&s[a].mean, sizeof(float), 3, stdout);
+			for (i = 0; i < npeaks; i++) {
+				fwrite(&s[a].pk_f[i], sizeof(float), 1, stdout);
+				fwrite(&s[a].pk_a[i], sizeof(float), 1, stdout);
+			}
+			fwrite(s[a].band, sizeof(float), nbands, stdout);
+		}
+	} else {
+		for (a = 0; a < 3; a++) {
+			printf("%lld.%03lld %c fs %.1f mean %.4f rms %.4f peak %.4f |",
+			       (long long)(ts / 1000000000),
+			       (long long)(ts % 1000000000 / 1000000), 'X' + a,
+			       fs, s[a].mean, s[a].rms, s[a].peak);
+			for (i = 0; i < npeaks; i++)
+				printf(" %.1f %.4f", s[a].pk_f[i], s[a].pk_a[i]);
+			printf(" |");
+			for (i = 0; i < nbands; i++)
+				printf(" %.4f", s[a].band[i]);
+			printf("\n");
+		}
+	}
+	fflush(stdout);
+}
+
+static void analyze(void)
+{
+	struct axis_sum s[3];
+	int64_t span = hist_ts[fft_n - 1] - hist_ts[0];
+	float fs = span > 0 ? (fft_n - 1) * 1e9 / span : rate_hint;
+	int a;
+
+	for (a = 0; a < 3; a++) {
+		s16_to_f32(hist[a], ax[a], fft_n, scale);
+		stats_f32(ax[a], fft_n, &s[a].mean, &s[a].rms, &s[a].peak);
+	}
+	window_f32(ax[0], re, fft_n, s[0].mean);
+	window_f32(ax[1], im, fft_n, s[1].mean);
+	fft(fft_n);
+	split_power(pw[0], pw[1], fft_n);
+
+	window_f32(ax[2], re, fft_n, s[2].mean);
+	memset(im, 0, fft_n * sizeof(float));
+	fft(fft_n);
+	power_f32(pw[2], fft_n / 2 + 1);
+
+	for (a = 0; a < 3; a++)
+		summarize(pw[a], fft_n, fs, &s[a]);
+	emit(hist_ts[fft_n / 2] + to_wall, fs, s);
+}
+
+// ---------------------------------------------------------------- main
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-n fft size] [-o overlap %%] [-k peaks] [-b bands]\n"
+		"          [-s m/s^2 per LSB] [-r Hz] [-c] [file|-]\n"
+		"  file defaults to /dev/adxl345_stream0, '-' is stdin\n", prog);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	static char buf[4096 * sizeof(struct adxl345_sample)];
+	const char *path = "/dev/adxl345_stream0";
+	size_t have = 0, off;
+	int fd, c, fill = 0, hop, first = 1;
+	ssize_t n;
+
+	while ((c = getopt(argc, argv, "n:o:k:b:s:r:ch")) != -1) {
+		switch (c) {
+		case 'n': fft_n = atoi(optarg); break;
+		case 'o': overlap = atoi(optarg); break;
+		case 'k': npeaks = atoi(optarg); break;
+		case 'b': nbands = atoi(optarg); break;
+		case 's': scale = atof(optarg); break;
+		case 'r': rate_hint = atof(optarg); break;
+		case 'c': compact = 1; break;
+		default: usage(argv[0]);
+		}
+	}
+	if (optind < argc)
+		path = argv[optind];
+	if (fft_n < 64 || fft_n > 65536 || (fft_n & (fft_n - 1)) ||
+	    overlap < 0 || overlap > 90 || npeaks < 0 || npeaks > MAX_PEAKS ||
+	    nbands < 1 || nbands > MAX_BANDS || (fft_n / 2) >> (nbands - 1) < 2)
+		usage(argv[0]);
+	hop = fft_n - fft_n * overlap / 100;
+
+	fd = strcmp(path, "-") ? open(path, O_RDONLY) : 0;
+	if (fd < 0) {
+		perror(path);
+		return 1;
+	}
+	if (setup(fft_n)) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	for (;;) {
+		n = read(fd, buf + have, sizeof(buf) - have);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		have += n;
+		off = 0;
+
+		if (first) {
+			struct adxl345_log_hdr hdr;
+
+			if (have < sizeof(hdr))
+				continue;
+			memcpy(&hdr, buf, sizeof(hdr));
+			if (hdr.magic == ADXL345_LOG_MAGIC) {
+				if (hdr.record_size != sizeof(struct adxl345_sample)) {
+					fprintf(stderr, "unknown record size %u\n",
+						hdr.record_size);
+					return 1;
+				}
+				scale = hdr.scale_nano / 1e9;
+				rate_hint = hdr.rate_mhz / 1e3;
+				to_wall = hdr.start_realtime - hdr.start_monotonic;
+				off = sizeof(hdr);
+			}
+			first = 0;
+		}
+
+		for (; off + sizeof(struct adxl345_sample) <= have;
+		     off += sizeof(struct adxl345_sample)) {
+			struct adxl345_sample s;
+
+			memcpy(&s, buf + off, sizeof(s));
+			hist[0][fill] = s.x;
+			hist[1][fill] = s.y;
+			hist[2][fill] = s.z;
+			hist_ts[fill] = s.timestamp;
+			if (++fill < fft_n)
+				continue;
+			analyze();
+			fill = fft_n - hop;
+			for (c = 0; c < 3; c++)
+				memmove(hist[c], hist[c] + hop, fill * sizeof(int16_t));
+			memmove(hist_ts, hist_ts + hop, fill * sizeof(int64_t));
+		}
+		// Keep a partial record for the next read
+		have -= off;
+		memmove(buf, buf + off, have);
+	}
+	return 0;
+}
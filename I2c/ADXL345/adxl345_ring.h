@@ -0,0 +1,70 @@
+#ifndef _ADXL345_RING_H_
+#define _ADXL345_RING_H_
+
+/*
+ * Record format of /dev/adxl345_stream<N> and layout of the shared ring
+ * behind /dev/adxl345_ring<N>. Included by the driver and by userspace readers.
+ */
+#include <linux/types.h>
+
+/* One sample : read() from adxl345_stream, one ring slot on adxl345_ring */
+struct adxl345_sample {
+	__s64 timestamp;	/* ns, CLOCK_MONOTONIC */
+	__s16 x, y, z;		/* LSB, after decimation and calibration */
+	__s16 pad;
+};
+
+#define ADXL345_RING_MAGIC	0x41584c52	/* "AXLR" */
+#define ADXL345_RING_VERSION	2
+
+/*
+ * The mapping is three regions : this header page, the reader's control
+ * page at ctl_offset, and the records at data_offset. Everything but the
+ * control page is read-only to userspace; the driver keeps its own head
+ * and size and only publishes copies here, it never trusts what is in the
+ * mapping except tail, which it clamps. Both indexes are free running,
+ * slot = index & (size - 1), head - tail = records queued.
+ *
+ *   map one page read-only, check magic and version
+ *   map map_size bytes read-only at 0, one page read-write at ctl_offset
+ *   loop: poll(POLLIN)              fires at ring_watermark records
+ *         h = head  (acquire)       then consume slots tail .. h - 1
+ *         ctl->tail = h  (release)
+ *
+ * A full ring drops new records and counts them in dropped.
+ */
+struct adxl345_ring_hdr {
+	__u32 magic;
+	__u32 version;
+	__u32 map_size;		/* bytes to mmap */
+	__u32 data_offset;	/* first record, from the start of the map */
+	__u32 ctl_offset;	/* struct adxl345_ring_ctl, also its mmap offset */
+	__u32 size;		/* records, power of 2 */
+	__u32 record_size;	/* sizeof(struct adxl345_sample) */
+	__u32 head;		/* next slot the driver fills */
+	__u32 dropped;
+};
+
+/* Page at ctl_offset, the only one userspace may write */
+struct adxl345_ring_ctl {
+	__u32 tail;		/* next slot the reader consumes */
+};
+
+/*
+ * Log files written by the ADXL345 logger (ADXL345.c) : this header, then
+ * struct adxl345_sample records back to back until end of file.
+ */
+#define ADXL345_LOG_MAGIC	0x314c5841	/* "AXL1" */
+
+struct adxl345_log_hdr {
+	__u32 magic;
+	__u32 record_size;
+	__u32 rate_mhz;		/* record rate, ODR / filter_decimation, mHz */
+	__u32 scale_nano;	/* m/s^2 per LSB * 1e9 */
+	/* CLOCK_REALTIME / CLOCK_MONOTONIC pair taken together at start, ns :
+	 * wall time of a record = timestamp - start_monotonic + start_realtime */
+	__s64 start_realtime;
+	__s64 start_monotonic;
+};
+
+#endif /* _ADXL345_RING_H_ */
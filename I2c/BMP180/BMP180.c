@@ -1,123 +1,445 @@
-// Distributed with a free-will license.
-// Use it any way you want, profit or free, provided it fits in the licenses of its associated works.
-// BMP180
-// This code is designed to work with the BMP180_I2CS I2C Mini Module available from ControlEverything.com.
-// https://www.controleverything.com/content/Pressure?sku=BMP180_I2CS#tabs-0-product_tabset-2
+//arm-linux-gcc -O2 BMP180.c -o BMP180 -lm
+// BMP180 sampler : temperature, pressure and altitude at a fixed rate, for
+// bring-up and field diagnostics.
+//
+//   ./BMP180 -r 50 -p 0 -d 60 > run.csv          no driver, over i2c-dev (default)
+//   ./BMP180 -f bin -o run.bin -r 20 -p 3        same, binary records
+//   ./BMP180 -s dev -r 10                         bmp180.ko, /dev/bmp180-1-77
+//
+// In i2c mode the calibration EEPROM is read once, then every cycle starts
+// a temperature conversion, sleeps only the datasheet conversion time
+// (4.5 ms, then 4.5/7.5/13.5/25.5 ms for OSS 0..3), reads UT, does the same
+// for pressure and sleeps until the next absolute deadline. One cycle costs
+// 9..30 ms plus bus time, so tens of Hz are reachable at low OSS.
+// In dev mode the driver samples (Sample_interval_ms, Oss) and the tool
+// only waits for its records.
+//
+// CSV : timestamp_ns,temp_c,pressure_pa,altitude_m
+// bin : struct bmp180_record back to back (bmp180_record.h), as /dev/bmp180-<bus>-77
+// Every -i seconds and at the end the achieved rate, conversion latency
+// and missed deadlines go to stderr.
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <linux/i2c-dev.h>
-#include <sys/ioctl.h>
-#include <fcntl.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
 #include <math.h>
+#include <signal.h>
+#include <getopt.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#include "bmp180_record.h"
+
+#define BMP180_ADDR	0x77
+// bmp180-<bus>-77 for -b /dev/i2c-<bus>, see dev_names()
+static char rec_dev[32];
+static char sysfs_dir[32];
+
+static const char *source = "i2c";
+static const char *bus = "/dev/i2c-1";
+static const char *out_path = "-";
+static int binary;
+static double rate = 10;
+static double duration;			// s, 0 = until Ctrl-C
+static double report_every = 10;	// s
+static int oss = 1;
+static double sea_level = 101325;	// Pa
+
+static const int temp_us = 4500;
+static const int pres_us[4] = { 4500, 7500, 13500, 25500 };
+
+static volatile sig_atomic_t stop;
+static FILE *out;
+
+static struct {
+	uint64_t samples;
+	uint64_t missed;		// deadlines skipped, or seq gaps in dev mode
+	uint64_t errors;		// failed bus transfers
+	int64_t first_ts, last_ts;
+	int64_t conv_min, conv_max, conv_sum;	// start of UT .. UP read, ns
+	int64_t late_max;		// cycle start after its deadline, ns
+	uint64_t win_samples;
+	int64_t win_start;
+} stats;
+
+static int64_t now_ns(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (int64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static void sleep_until(int64_t t)
+{
+	struct timespec ts = { .tv_sec = t / 1000000000, .tv_nsec = t % 1000000000 };
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR &&
+	       !stop)
+		;
+}
+
+// ---------------------------------------------------------------- output
+
+static void put_record(const struct bmp180_record *r)
+{
+	if (binary)
+		fwrite(r, sizeof(*r), 1, out);
+	else
+		fprintf(out, "%lld,%.1f,%d,%.2f\n", (long long)r->timestamp,
+			r->temp / 10.0, r->pressure, r->altitude / 100.0);
+
+	if (!stats.samples)
+		stats.first_ts = stats.win_start = r->timestamp;
+	stats.last_ts = r->timestamp;
+	stats.samples++;
+	stats.win_samples++;
+}
+
+static void report(int final)
+{
+	double span = (stats.last_ts - stats.first_ts) / 1e9;
+	double win = (stats.last_ts - stats.win_start) / 1e9;
+	uint64_t conv_n = stats.samples ? stats.samples : 1;
+
+	if (final)
+		fprintf(stderr, "%llu samples in %.3f s : %.2f Hz (requested %.2f), "
+			"%llu missed, %llu errors\n",
+			(unsigned long long)stats.samples, span,
+			span > 0 ? (stats.samples - 1) / span : 0.0, rate,
+			(unsigned long long)stats.missed,
+			(unsigned long long)stats.errors);
+	else
+		fprintf(stderr, "%llu samples, %.2f Hz, %llu missed\n",
+			(unsigned long long)stats.samples,
+			win > 0 ? stats.win_samples / win : 0.0,
+			(unsigned long long)stats.missed);
+	if (stats.conv_max)
+		fprintf(stderr, "  conversion %.2f / %.2f / %.2f ms (min/avg/max), "
+			"worst start latency %.3f ms\n",
+			stats.conv_min / 1e6, stats.conv_sum / 1e6 / conv_n,
+			stats.conv_max / 1e6, stats.late_max / 1e6);
+	fflush(out);
+	stats.win_samples = 0;
+	stats.win_start = stats.last_ts;
+}
+
+static int deadline_passed(int64_t deadline)
+{
+	static int64_t next_report;
+	int64_t now = now_ns();
+
+	if (!next_report)
+		next_report = now + (int64_t)(report_every * 1e9);
+	if (report_every > 0 && now >= next_report) {
+		report(0);
+		next_report += (int64_t)(report_every * 1e9);
+	}
+	return stop || (deadline && now >= deadline);
+}
+
+// ---------------------------------------------------------------- i2c-dev
+
+struct calib {
+	int16_t ac1, ac2, ac3;
+	uint16_t ac4, ac5, ac6;
+	int16_t b1, b2, mb, mc, md;
+};
+
+static int i2c_read(int fd, uint8_t reg, uint8_t *buf, int len)
+{
+	struct i2c_msg msg[2] = {
+		{ .addr = BMP180_ADDR, .flags = 0, .len = 1, .buf = &reg },
+		{ .addr = BMP180_ADDR, .flags = I2C_M_RD, .len = len, .buf = buf },
+	};
+	struct i2c_rdwr_ioctl_data xfer = { .msgs = msg, .nmsgs = 2 };
+
+	return ioctl(fd, I2C_RDWR, &xfer) == 2 ? 0 : -1;
+}
+
+static int i2c_write(int fd, uint8_t reg, uint8_t val)
+{
+	uint8_t buf[2] = { reg, val };
+
+	return write(fd, buf, 2) == 2 ? 0 : -1;
+}
+
+// Calibration EEPROM 0xAA..0xBF in one transfer, big endian words
+static int read_calib(int fd, struct calib *c)
+{
+	uint8_t d[22];
+	uint16_t w[11];
+	int i;
+
+	if (i2c_read(fd, 0xAA, d, sizeof(d)))
+		return -1;
+	for (i = 0; i < 11; i++) {
+		w[i] = d[2 * i] << 8 | d[2 * i + 1];
+		if (w[i] == 0x0000 || w[i] == 0xFFFF)
+			return -1;
+	}
+	c->ac1 = w[0]; c->ac2 = w[1]; c->ac3 = w[2];
+	c->ac4 = w[3]; c->ac5 = w[4]; c->ac6 = w[5];
+	c->b1 = w[6];  c->b2 = w[7];  c->mb = w[8];
+	c->mc = w[9];  c->md = w[10];
+	return 0;
+}
 
-void main() 
+// Datasheet integer compensation, same as the driver : 0.1 C and Pa
+static void compensate(const struct calib *c, int32_t ut, int32_t up,
+		       struct bmp180_record *r)
 {
-	// Create I2C bus
-	int file;
-	char *bus = "/dev/i2c-1";
-	if((file = open(bus, O_RDWR)) < 0) 
-	{
-		printf("Failed to open the bus. \n");
+	int32_t x1, x2, x3, b3, b5, b6, p;
+	uint32_t b4, b7;
+
+	// (UT - AC6) * AC5 reaches 2^32 for a UT far off AC6
+	x1 = ((int64_t)(ut - c->ac6) * c->ac5) >> 15;
+	x2 = (x1 + c->md) ? (c->mc * 2048) / (x1 + c->md) : 0;
+	b5 = x1 + x2;
+	r->temp = (b5 + 8) >> 4;
+
+	b6 = b5 - 4000;
+	x1 = (c->b2 * ((b6 * b6) >> 12)) >> 11;
+	x2 = (c->ac2 * b6) >> 11;
+	x3 = x1 + x2;
+	b3 = ((((int32_t)c->ac1 * 4 + x3) << oss) + 2) / 4;
+	x1 = (c->ac3 * b6) >> 13;
+	x2 = (c->b1 * ((b6 * b6) >> 12)) >> 16;
+	x3 = ((x1 + x2) + 2) >> 2;
+	b4 = (c->ac4 * (uint32_t)(x3 + 32768)) >> 15;
+	b7 = ((uint32_t)up - b3) * (50000 >> oss);
+	if (!b4) {
+		r->pressure = 0;
+		return;
+	}
+	p = b7 < 0x80000000 ? (b7 * 2) / b4 : (b7 / b4) * 2;
+	x1 = (p >> 8) * (p >> 8);
+	x1 = (x1 * 3038) >> 16;
+	x2 = (-7357 * p) >> 16;
+	r->pressure = p + ((x1 + x2 + 3791) >> 4);
+}
+
+static void run_i2c(int64_t deadline)
+{
+	int64_t period = (int64_t)(1e9 / rate), next, t0, conv, late;
+	struct bmp180_record r;
+	struct calib c;
+	uint8_t d[3];
+	int32_t ut, up;
+	uint32_t seq = 0;
+	int fd;
+
+	fd = open(bus, O_RDWR);
+	if (fd < 0) {
+		perror(bus);
+		exit(1);
+	}
+	if (ioctl(fd, I2C_SLAVE, BMP180_ADDR) < 0) {
+		perror("I2C_SLAVE (is bmp180.ko bound? rmmod it or use -s dev)");
 		exit(1);
 	}
-	// Get I2C device, VEML6070 I2C address is 0x77(119)
-	ioctl(file, I2C_SLAVE, 0x77);
-
-	// Calibration Cofficients stored in EEPROM of the device
-	// Read 22 bytes of data from address 0xAA(170)
-	char data[22] = {0};
-	read(file, data, 22);
-
-	// Convert the data
-	int AC1 = data[0] * 256 + data[1];
-	int AC2 = data[2] * 256 + data[3];
-	int AC3 = data[4] * 256 + data[5];
-	int AC4 = data[6] * 256 + data[7];
-	int AC5 = data[8] * 256 + data[9];
-	int AC6 = data[10] * 256 + data[11];
-	int B1 = data[12] * 256 + data[13];
-	int B2 = data[14] * 256 + data[15];
-	int MB = data[16] * 256 + data[17];
-	int MC = data[18] * 256 + data[19];
-	int MD = data[20] * 256 + data[21];
-	sleep(1);
-
-	// Select measurement control register(0xF4)
-	// Enable temperature measurement(0x2E)
-	char config[2]= {0};
-	config[0] = 0xF4;
-	config[1] = 0x2E;
-	write(file, config, 2);
-	sleep(1);
-	
-	// Read 2 bytes of data from register(0xF6)
-	// temp msb, temp lsb
-	char reg[1] = {0xF6};
-	write(file, reg, 1);
-	if(read(file, data, 2) != 2)
-	{
-		printf("Erorr : Input/output Erorr \n");
+	if (read_calib(fd, &c)) {
+		fprintf(stderr, "can not read the calibration EEPROM\n");
 		exit(1);
 	}
+	if (period < (temp_us + pres_us[oss]) * 1000LL)
+		fprintf(stderr, "warning : %.2f Hz is faster than one OSS %d "
+			"measurement (%.1f ms), running back to back\n",
+			rate, oss, (temp_us + pres_us[oss]) / 1000.0);
+
+	next = now_ns();
+	while (!deadline_passed(deadline)) {
+		sleep_until(next);
+		t0 = now_ns();
+		late = t0 - next;
+		if (late > stats.late_max)
+			stats.late_max = late;
+
+		if (i2c_write(fd, 0xF4, 0x2E))			// temperature
+			goto err;
+		sleep_until(t0 + temp_us * 1000LL);
+		if (i2c_read(fd, 0xF6, d, 2))
+			goto err;
+		ut = d[0] << 8 | d[1];
+		if (i2c_write(fd, 0xF4, 0x34 | oss << 6))	// pressure
+			goto err;
+		sleep_until(now_ns() + pres_us[oss] * 1000LL);
+		if (i2c_read(fd, 0xF6, d, 3))
+			goto err;
+		r.timestamp = now_ns();
+		up = (d[0] << 16 | d[1] << 8 | d[2]) >> (8 - oss);
 
-	// Convert the data
-	int temp = (data[0] * 256 + data[1]);
-
-	// Select measurement control register(0xf4)
-	// Enable pressure measurement, OSS = 1(0x74)
-	config[0] = 0xF4;
-	config[1] = 0x74;
-	write(file, config, 2);
-	sleep(1);
-	
-	// Read 3 bytes of data from register(0xF6)
-	// pres msb1, pres msb, pres lsb
-	reg[0] = 0xF6;
-	write(file, reg, 1);
-	read(file, data, 3);
-
-	// Convert the data
-	long pres = (data[0] * 65536 + (data[1] * 256) + data[2]) / 128;
-
-	// Callibration for Temperature
-	long X1 = (temp - AC6) * AC5 / 32768.0;
-	long X2 = (MC * 2048.0) / (X1 + MD);
-	long B5 = X1 + X2;
-	long cTemp = ((B5 + 8.0) / 16.0) / 10.0;
-	long fTemp = cTemp * 1.8 + 32;
-
-	// Calibration for Pressure
-	long B6 = B5 - 4000;
-	X1 = (B2 * (B6 * B6 / 4096.0)) / 2048.0;
-	X2 = AC2 * B6 / 2048.0;
-	long X3 = X1 + X2;
-	long B3 = (((AC1 * 4 + X3) * 2) + 2) / 4.0;
-	X1 = AC3 * B6 / 8192.0;
-	X2 = (B1 * (B6 * B6 / 2048.0)) / 65536.0;
-	X3 = ((X1 + X2) + 2) / 4.0;
-	long B4 = AC4 * (X3 + 32768) / 32768.0;
-	long B7 = ((pres - B3) * (25000.0));
-	long pressure = 0.0;
-	if(B7 < 2147483648L)
-	{
-		pressure = (B7 * 2) / B4;
+		conv = r.timestamp - t0;
+		if (!stats.conv_min || conv < stats.conv_min)
+			stats.conv_min = conv;
+		if (conv > stats.conv_max)
+			stats.conv_max = conv;
+		stats.conv_sum += conv;
+
+		compensate(&c, ut, up, &r);
+		r.altitude = (int32_t)lround(4433000.0 *
+				(1 - pow(r.pressure / sea_level, 1 / 5.255)));
+		r.seq = seq++;
+		put_record(&r);
+		goto next;
+err:
+		stats.errors++;
+next:
+		// Fixed schedule : a cycle that overran skips its lost slots
+		next += period;
+		t0 = now_ns();
+		if (t0 > next) {
+			stats.missed += (t0 - next) / period;
+			next += (t0 - next) / period * period;
+		}
 	}
+	close(fd);
+}
+
+// ---------------------------------------------------------------- bmp180.ko
+
+static int sysfs_write(const char *attr, long val)
+{
+	char path[128];
+	FILE *f;
+	int ret;
+
+	snprintf(path, sizeof(path), "%s/%s", sysfs_dir, attr);
+	f = fopen(path, "w");
+	if (!f)
+		return -1;
+	ret = fprintf(f, "%ld\n", val) < 0;
+	return fclose(f) || ret ? -1 : 0;
+}
+
+// The driver names its sysfs directory and record device after bus and address
+static void dev_names(void)
+{
+	const char *p = strrchr(bus, '-');
+	int nr = p ? atoi(p + 1) : 1;
+
+	snprintf(sysfs_dir, sizeof(sysfs_dir), "/sys/bmp180-%d-%02x", nr,
+		 BMP180_ADDR);
+	snprintf(rec_dev, sizeof(rec_dev), "/dev/bmp180-%d-%02x", nr,
+		 BMP180_ADDR);
+}
+
+static void run_dev(int64_t deadline)
+{
+	struct bmp180_record r[64];
+	struct pollfd pfd;
+	uint32_t expect = 0;
+	long interval = lround(1000 / rate);
+	int fd, n, i;
+
+	dev_names();
+	if (sysfs_write("Oss", oss) ||
+	    sysfs_write("Sea_level_Pa", lround(sea_level)) ||
+	    sysfs_write("Sample_interval_ms", interval)) {
+		fprintf(stderr, "%s (interval 40 .. 3600000 ms) : %s\n",
+			sysfs_dir, strerror(errno));
+		exit(1);
+	}
+	fd = open(rec_dev, O_RDONLY);
+	if (fd < 0) {
+		perror(rec_dev);
+		exit(1);
+	}
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	while (!deadline_passed(deadline)) {
+		if (poll(&pfd, 1, 100) <= 0)
+			continue;
+		if (pfd.revents & POLLHUP)
+			break;
+		n = read(fd, r, sizeof(r));
+		if (n < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			perror("read");
+			break;
+		}
+		for (i = 0; i < n / (int)sizeof(r[0]); i++) {
+			if (stats.samples && r[i].seq != expect)
+				stats.missed += r[i].seq - expect;
+			expect = r[i].seq + 1;
+			put_record(&r[i]);
+		}
+	}
+	close(fd);
+	sysfs_write("Sample_interval_ms", 0);
+}
+
+// ---------------------------------------------------------------- main
+
+static void on_signal(int sig)
+{
+	(void)sig;
+	stop = 1;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-s i2c|dev] [-b i2c-bus] [-r Hz] [-p oss 0..3]\n"
+		"          [-d seconds] [-f csv|bin] [-o file] [-i report seconds]\n"
+		"          [-l sea level Pa]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int64_t deadline = 0;
+	int c;
+
+	while ((c = getopt(argc, argv, "s:b:r:p:d:f:o:i:l:h")) != -1) {
+		switch (c) {
+		case 's': source = optarg; break;
+		case 'b': bus = optarg; break;
+		case 'r': rate = atof(optarg); break;
+		case 'p': oss = atoi(optarg); break;
+		case 'd': duration = atof(optarg); break;
+		case 'f': binary = !strcmp(optarg, "bin"); break;
+		case 'o': out_path = optarg; break;
+		case 'i': report_every = atof(optarg); break;
+		case 'l': sea_level = atof(optarg); break;
+		default: usage(argv[0]);
+		}
+	}
+	if (rate <= 0 || oss < 0 || oss > 3 || sea_level <= 0)
+		usage(argv[0]);
+
+	out = strcmp(out_path, "-") ? fopen(out_path, binary ? "wb" : "w") : stdout;
+	if (!out) {
+		perror(out_path);
+		return 1;
+	}
+	if (!binary)
+		fprintf(out, "timestamp_ns,temp_c,pressure_pa,altitude_m\n");
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+	if (duration > 0)
+		deadline = now_ns() + (int64_t)(duration * 1e9);
+
+	if (!strcmp(source, "i2c"))
+		run_i2c(deadline);
+	else if (!strcmp(source, "dev"))
+		run_dev(deadline);
 	else
-	{
-		pressure = (B7 / B4) * 2;
+		usage(argv[0]);
+
+	report(1);
+	if (out != stdout && fclose(out)) {
+		perror(out_path);
+		return 1;
 	}
-	X1 = (pressure / 256.0) * (pressure / 256.0);
-	X1 = (X1 * 3038.0) / 65536.0;
-	X2 = ((-7357) * pressure) / 65536.0;
-	long pressure1 = (pressure + (X1 + X2 + 3791) / 16.0) / 100;
-
-	// Calculate Altitude
-	long altitude = 44330 * (1 - pow(pressure1/1013.25, 0.1903));
-
-	// Output data to screen
-	printf("Altitude : %.2f m \n", altitude);
-	printf("Pressure : %.2f hPa \n", pressure1);
-	printf("Temperature in Celsius : %.2f C \n", cTemp);
-	printf("Temperature in Fahrenheit : %.2f F \n", fTemp);
+	return stats.errors || stats.missed ? 2 : 0;
 }
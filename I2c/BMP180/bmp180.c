@@ -1,6 +1,6 @@
 /*Programming steps :
  * Step 1: Get I2C device, VEML6070 I2C address is 0x77(119)
- * Step 2: Calibration Cofficients stored in EEPROM of the device
+ * Step 2: Calibration Cofficients stored in EEPROM of the device, once at probe
  * 		Read 22 bytes of data from address 0xAA(170)
  * Step 3: Select measurement control register(0xF4)
  * 		Enable temperature measurement(0x2E)
@@ -20,50 +20,116 @@
 #include <linux/kobject.h>
 #include <linux/jiffies.h>
 #include <linux/delay.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/hrtimer.h>
+#include <linux/workqueue.h>
+#include <linux/wait.h>
+#include <linux/interrupt.h>
+#include <linux/math64.h>
+#include <linux/kfifo.h>
+#include <linux/cdev.h>
+#include <linux/fs.h>
+#include <linux/poll.h>
+#include <linux/kref.h>
+#include <linux/idr.h>
+#include <asm/unaligned.h>
 
+#include "bmp180_record.h"
 
-/*BMP180_coeff_reg */ 
-static int AC1,AC2,AC3,AC4,AC5,AC6,B1,B2,MB,MC,MD;
+
+/*
+ * Calibration EEPROM : 11 big endian words at 0xAA..0xBF, AC4..AC6 unsigned.
+ * Constant for the life of the part, read once at probe.
+ */
+struct bmp180_calib {
+	s16 ac1, ac2, ac3;
+	u16 ac4, ac5, ac6;
+	s16 b1, b2, mb, mc, md;
+};
+
+/* One temperature + pressure measurement, uncompensated */
+struct bmp180_raw {
+	s32 ut;
+	s32 up;			/* already shifted right by 8 - oss */
+	u8 oss;
+	ktime_t timestamp;	/* CLOCK_MONOTONIC, pressure stage done */
+};
+
+/* Compensated measurement */
+struct bmp180_reading {
+	s32 temp;		/* 0.1 C */
+	s32 pressure;		/* Pa */
+	s32 altitude;		/* cm above prv->sea_level */
+	ktime_t timestamp;
+};
+
+enum bmp180_state {
+	BMP180_IDLE,
+	BMP180_TEMP,		/* temperature conversion running */
+	BMP180_PRES,		/* pressure conversion running */
+};
 
 struct bmp180_prv {
-	struct i2c_client client_prv;
+	struct i2c_client *client;
 	struct kobject *bmp180_kobj;
+	struct bmp180_calib calib;
+	struct list_head node;
+
+	/* conversion engine, prv->lock protects all of it */
+	struct mutex lock;
+	enum bmp180_state state;
+	bool dead;
+	u8 oss;			/* for the next measurement */
+	struct bmp180_raw raw;	/* measurement in flight */
+	ktime_t started;	/* of the measurement in flight */
+	struct bmp180_reading last;	/* last completed measurement */
+	bool valid;		/* last holds one */
+	int err;		/* status of the last measurement */
+	unsigned int seq;	/* bumped when a measurement ends */
+	wait_queue_head_t wait;
+	struct hrtimer timer;
+	struct work_struct work;
+
+	unsigned int sea_level;	/* Pa, altitude reference */
+
+	/* periodic sampling, 0 = off, under prv->lock */
+	unsigned int interval_ms;
+	unsigned int max_age_ms;	/* sysfs readers accept last up to this old */
+	struct delayed_work sample_work;
+
+	/* /dev/bmp180-<bus>-<addr>, open files on readers under prv->lock */
+	struct kref ref;		/* probe + one per open file */
+	u32 count;			/* completed measurements */
+	struct list_head readers;
+	wait_queue_head_t rec_wait;
+	dev_t devt;
+	struct cdev cdev;
 };
 
-struct bmp180_prv *prv=NULL;
+struct bmp180_reader {
+	struct bmp180_prv *prv;
+	struct list_head node;
+	struct mutex read_lock;
+	DECLARE_KFIFO(fifo, struct bmp180_record, BMP180_RECORD_QUEUE);
+};
+
+static LIST_HEAD(bmp180_chips);
+static DEFINE_MUTEX(bmp180_chips_lock);
 
+/* Record devices : one region and class for all chips, a minor each */
+#define BMP180_MAX_CHIPS	8
+static dev_t bmp180_devt;
+static struct class *bmp180_class;
+static DEFINE_IDA(bmp180_minors);
 
 /* The BMP180  registers */
 enum BMP180_Reg {
 	BMP180_CTR      = 0xF4, 	//measurement control register
 };
 
-enum BMP180_coeff_reg_MSB {
-	AC1_MSB		= 0xAA,
-	AC2_MSB 	= 0xAC,
-	AC3_MSB		= 0xAE, 
-	AC4_MSB 	= 0xB0,
-	AC5_MSB 	= 0xB2,
-	AC6_MSB	 	= 0xB4,
-	B1_MSB		= 0xB6, 
-	B2_MSB		= 0xB8, 
-	MB_MSB		= 0xBA, 
-	MC_MSB		= 0xBC, 
-	MD_MSB		= 0xBE, 
-};
-enum BMP180_coeff_reg_LSB {
-	AC1_LSB		= 0xAB,
-	AC2_LSB 	= 0xAD,
-	AC3_LSB		= 0xAF, 
-	AC4_LSB 	= 0xB1,
-	AC5_LSB 	= 0xB3,
-	AC6_LSB	 	= 0xB5,
-	B1_LSB		= 0xB7, 
-	B2_LSB		= 0xB9, 
-	MB_LSB		= 0xBB, 
-	MC_LSB		= 0xBD, 
-	MD_LSB		= 0xBF, 
-};
+#define BMP180_CALIB		0xAA	/* AC1_MSB, first calibration byte */
+#define BMP180_CALIB_LEN	22
 
 enum Config_Param {
 	En_Temp_M	= 0x2E,   // Enable temperature measurement(0x2E)
@@ -79,17 +145,12 @@ enum Data_reg{
 };
 
 static unsigned bmp180_timeout = 25; /*default timeout for normal I2c  devices */
+
+/* Datasheet maximum conversion times, us */
+#define BMP180_TEMP_US		4500
+static const unsigned int bmp180_pres_us[4] = { 4500, 7500, 13500, 25500 };
 /* register access */
 
-static int power(int param1, unsigned int param2)
-{
-    if (param2 == 0)
-        return 1;
-    else if (param2%2 == 0)
-        return power(param1, param2/2) * power(param1, param2/2);
-    else
-        return param1 * power(param1, param2/2) * power(param1, param2/2);
-}
 static int bmp180_read_value(struct i2c_client *client, u8 reg)
 {
 	return i2c_smbus_read_byte_data(client, reg);
@@ -100,192 +161,598 @@ static int bmp180_write_value(struct i2c_client *client, u8 reg, u16 value)
 {
 	return i2c_smbus_write_byte_data(client, reg, value);
 }
-static void get_Calibration_coeff(struct i2c_client *client)
-{
-	AC1 = ( bmp180_read_value(client,AC1_MSB) << 8 ) + bmp180_read_value(client,AC1_LSB);	
-	AC2 = ( bmp180_read_value(client,AC2_MSB) << 8 ) + bmp180_read_value(client,AC2_LSB);	
-	AC3 = ( bmp180_read_value(client,AC3_MSB) << 8 ) + bmp180_read_value(client,AC3_LSB);	
-	AC4 = ( bmp180_read_value(client,AC4_MSB) << 8 ) + bmp180_read_value(client,AC4_LSB);	
-	AC5 = ( bmp180_read_value(client,AC5_MSB) << 8 ) + bmp180_read_value(client,AC5_LSB);	
-	AC6 = ( bmp180_read_value(client,AC6_MSB) << 8 ) + bmp180_read_value(client,AC6_LSB);	
-	B1  = ( bmp180_read_value(client,B1_MSB) << 8 ) + bmp180_read_value(client,B1_LSB); 
-	B2  = ( bmp180_read_value(client,B2_MSB) << 8 ) + bmp180_read_value(client,B2_LSB);
-	MB  = ( bmp180_read_value(client,MB_MSB) << 8 ) + bmp180_read_value(client,MB_LSB); 
-	MC  = ( bmp180_read_value(client,MC_MSB) << 8 ) + bmp180_read_value(client,MC_LSB); 
-	MD  = ( bmp180_read_value(client,MD_MSB) << 8 ) + bmp180_read_value(client,MD_LSB);
-}
-static int get_temp_value(struct i2c_client *client )
-{
-	char data[2] ={0};
-	long temp;
-	unsigned long timeout, read_time;
-	/* Enable temperature */
-	bmp180_write_value(&prv->client_prv,BMP180_CTR,En_Temp_M);
-	timeout = jiffies + msecs_to_jiffies(bmp180_timeout);
-	do{
-		read_time = jiffies;
-		data[0] = bmp180_read_value(&prv->client_prv,UT); 
-		data[1] = bmp180_read_value(&prv->client_prv,UT + 1);
-		if (data[0] < 0 || data[1] < 0 )
-			pr_err("%s: Read error\n",__func__);
-		else{
-			 temp = ( data[0] << 8 ) + ( data[1] )  ; /* Convert the data*/ 
-			return temp;
-		}
-		msleep(1);
-	}while (time_before(read_time, timeout));
-	return -ETIMEDOUT;
-}
-static int get_pressure_value(struct i2c_client *client )
-{
-	char data[3] ={0};
-	long pressure;
-	unsigned long timeout, read_time;
-	/* Enable pressure measurement, OSS = 1(0x74) */
-	bmp180_write_value(&prv->client_prv,BMP180_CTR,En_Pres_M_1);
-	timeout = jiffies + msecs_to_jiffies(bmp180_timeout);
-	do{
-		read_time = jiffies;
-		data[0] = bmp180_read_value(client,UP); 
-		data[1] = bmp180_read_value(client,UP + 1);
-		data[2] = bmp180_read_value(client,UP + 2);
-		if (data[0] < 0 || data[1] < 0 ||  data[2] < 0)
-			pr_err("%s: Read error\n",__func__);
-		else{
-			 pressure= ( data[0] << 16 ) + ( data[1] << 8 ) + data[2] ; /* Convert the data*/ 
-			return pressure;
+static struct bmp180_prv *bmp180_from_kobj(struct kobject *kobj)
+{
+	struct bmp180_prv *prv, *found = NULL;
+
+	mutex_lock(&bmp180_chips_lock);
+	list_for_each_entry(prv, &bmp180_chips, node) {
+		if (prv->bmp180_kobj == kobj) {
+			found = prv;
+			break;
 		}
-		msleep(1);
-	}while (time_before(read_time, timeout));
-	return -ETIMEDOUT;
+	}
+	mutex_unlock(&bmp180_chips_lock);
+	return found;
+}
+
+/* All 22 calibration bytes in one combined write/read transfer */
+static int bmp180_read_calib(struct i2c_client *client, struct bmp180_calib *c)
+{
+	u8 buf[BMP180_CALIB_LEN];
+	u16 w[BMP180_CALIB_LEN / 2];
+	int ret, i;
+
+	ret = i2c_smbus_read_i2c_block_data(client, BMP180_CALIB,
+					    BMP180_CALIB_LEN, buf);
+	if (ret < 0)
+		return ret;
+	if (ret != BMP180_CALIB_LEN)
+		return -EIO;
+	for (i = 0; i < ARRAY_SIZE(w); i++) {
+		w[i] = get_unaligned_be16(&buf[2 * i]);
+		/* Datasheet : no word is ever 0x0000 or 0xFFFF on a good part */
+		if (w[i] == 0x0000 || w[i] == 0xFFFF)
+			return -EIO;
+	}
+	c->ac1 = w[0];
+	c->ac2 = w[1];
+	c->ac3 = w[2];
+	c->ac4 = w[3];
+	c->ac5 = w[4];
+	c->ac6 = w[5];
+	c->b1  = w[6];
+	c->b2  = w[7];
+	c->mb  = w[8];
+	c->mc  = w[9];
+	c->md  = w[10];
+	return 0;
+}
+/*
+ * Compensation, integer only, as in the datasheet flow chart (section 3.5).
+ * temp in 0.1 C, pressure in Pa.
+ */
+static void bmp180_compensate(const struct bmp180_calib *c,
+			      const struct bmp180_raw *raw,
+			      struct bmp180_reading *r)
+{
+	s32 x1, x2, x3, b3, b5, b6, p;
+	u32 b4, b7;
+
+	/* UT - AC6 times AC5 reaches 2^32 for a UT far off AC6 */
+	x1 = ((s64)(raw->ut - c->ac6) * c->ac5) >> 15;
+	x2 = (x1 + c->md) ? (c->mc << 11) / (x1 + c->md) : 0;
+	b5 = x1 + x2;
+	r->temp = (b5 + 8) >> 4;
+
+	b6 = b5 - 4000;
+	x1 = (c->b2 * ((b6 * b6) >> 12)) >> 11;
+	x2 = (c->ac2 * b6) >> 11;
+	x3 = x1 + x2;
+	b3 = ((((s32)c->ac1 * 4 + x3) << raw->oss) + 2) / 4;
+	x1 = (c->ac3 * b6) >> 13;
+	x2 = (c->b1 * ((b6 * b6) >> 12)) >> 16;
+	x3 = ((x1 + x2) + 2) >> 2;
+	b4 = (c->ac4 * (u32)(x3 + 32768)) >> 15;
+	b7 = ((u32)raw->up - b3) * (50000 >> raw->oss);
+	if (!b4) {
+		r->pressure = 0;
+		return;
+	}
+	if (b7 < 0x80000000)
+		p = (b7 * 2) / b4;
+	else
+		p = (b7 / b4) * 2;
+	x1 = (p >> 8) * (p >> 8);
+	x1 = (x1 * 3038) >> 16;
+	x2 = (-7357 * p) >> 16;
+	r->pressure = p + ((x1 + x2 + 3791) >> 4);
+}
+
+/*
+ * Altitude in cm, 4433000 * (1 - (p / p0) ^ (1 / 5.255)), sampled at
+ * p / p0 = 0.25 + i / 256. Linear interpolation between entries stays
+ * within 2 cm near sea level and 12 cm at the top of the table (~10 km).
+ */
+#define BMP180_ALT_BASE		(1 << 22)	/* 0.25 in Q24 */
+#define BMP180_ALT_SHIFT	16		/* Q24 step of 1 / 256 */
+static const s32 bmp180_alt_lut[257] = {
+	1027909, 1017848, 1007911, 998096, 988398, 978816, 969345, 959983,
+	950727, 941575, 932523, 923571, 914714, 905951, 897280, 888698,
+	880204, 871796, 863471, 855228, 847065, 838980, 830972, 823039,
+	815179, 807392, 799675, 792027, 784446, 776933, 769484, 762099,
+	754777, 747517, 740316, 733175, 726093, 719067, 712097, 705183,
+	698323, 691516, 684761, 678057, 671404, 664801, 658247, 651741,
+	645282, 638869, 632503, 626181, 619904, 613670, 607480, 601331,
+	595225, 589159, 583134, 577149, 571203, 565296, 559427, 553596,
+	547801, 542043, 536322, 530635, 524984, 519367, 513785, 508236,
+	502720, 497237, 491786, 486367, 480980, 475624, 470298, 465003,
+	459737, 454501, 449294, 444116, 438967, 433845, 428752, 423685,
+	418646, 413634, 408648, 403688, 398754, 393846, 388963, 384104,
+	379271, 374462, 369677, 364916, 360178, 355464, 350773, 346104,
+	341459, 336835, 332234, 327655, 323097, 318560, 314045, 309551,
+	305077, 300624, 296192, 291779, 287387, 283014, 278660, 274326,
+	270011, 265715, 261438, 257180, 252939, 248717, 244513, 240327,
+	236159, 232008, 227875, 223758, 219659, 215577, 211511, 207463,
+	203430, 199414, 195414, 191430, 187461, 183509, 179572, 175651,
+	171745, 167854, 163978, 160117, 156270, 152439, 148622, 144819,
+	141031, 137257, 133497, 129751, 126018, 122300, 118595, 114903,
+	111225, 107560, 103908, 100270, 96644, 93031, 89431, 85844,
+	82269, 78706, 75156, 71619, 68093, 64579, 61078, 57588,
+	54110, 50644, 47190, 43747, 40315, 36895, 33486, 30088,
+	26702, 23326, 19962, 16608, 13265, 9933, 6611, 3300,
+	0, -3290, -6570, -9839, -13098, -16347, -19586, -22815,
+	-26034, -29244, -32443, -35633, -38813, -41983, -45144, -48296,
+	-51438, -54570, -57694, -60808, -63913, -67009, -70096, -73174,
+	-76243, -79303, -82355, -85397, -88431, -91456, -94473, -97481,
+	-100481, -103472, -106455, -109430, -112396, -115354, -118304, -121246,
+	-124180, -127106, -130023, -132933, -135835, -138729, -141616, -144494,
+	-147365, -150229, -153085, -155933, -158774, -161607, -164433, -167251,
+	-170062, -172866, -175663, -178452, -181234, -184010, -186778, -189539,
+	-192293,
+};
+
+static s32 bmp180_altitude(s32 pressure, u32 sea_level)
+{
+	u32 ratio, idx, frac;
+	s32 a, b;
+
+	if (pressure <= 0 || !sea_level)
+		return 0;
+	/* p / p0 in Q24 */
+	ratio = div_u64((u64)pressure << 24, sea_level);
+	ratio = clamp_t(u32, ratio, BMP180_ALT_BASE,
+			BMP180_ALT_BASE + (256 << BMP180_ALT_SHIFT));
+	idx = (ratio - BMP180_ALT_BASE) >> BMP180_ALT_SHIFT;
+	frac = (ratio - BMP180_ALT_BASE) & ((1 << BMP180_ALT_SHIFT) - 1);
+	if (idx == 256)
+		return bmp180_alt_lut[256];
+	a = bmp180_alt_lut[idx];
+	b = bmp180_alt_lut[idx + 1];
+	return a + (((b - a) * (s32)frac) >> BMP180_ALT_SHIFT);
+}
+
+/*
+ * Conversion engine
+ *
+ * One measurement is temperature then pressure. Each stage writes
+ * BMP180_CTR and the result is collected when the conversion is known
+ * to be done : from the EOC interrupt when one is wired (client->irq),
+ * otherwise from an hrtimer armed for the datasheet maximum conversion
+ * time. Both only queue prv->work, the I2C traffic runs there.
+ *
+ * A reader that finds the engine idle starts a measurement, one that
+ * finds it busy waits for the measurement already in flight, so any
+ * number of readers cost a single conversion. Completed measurements
+ * are compensated once and kept in prv->last; readers accept it while
+ * it is younger than their max age. With Sample_interval_ms set,
+ * prv->sample_work starts a measurement every interval and readers are
+ * served from that snapshot, bus traffic no longer follows their number.
+ */
+static void bmp180_arm(struct bmp180_prv *prv, unsigned int usecs)
+{
+	if (prv->client->irq > 0)
+		return;
+	hrtimer_start(&prv->timer, ns_to_ktime((u64)usecs * NSEC_PER_USEC),
+		      HRTIMER_MODE_REL);
+}
+
+/* Called with prv->lock held */
+static void bmp180_finish(struct bmp180_prv *prv, int err)
+{
+	prv->err = err;
+	prv->state = BMP180_IDLE;
+	prv->seq++;
+	wake_up_all(&prv->wait);
+}
+
+/*
+ * Called with prv->lock held. A measurement older than the worst case
+ * conversion plus bmp180_timeout lost its EOC edge (or the bus wedged) :
+ * fail it and start over, whoever asks, so periodic sampling can not
+ * stall behind it waiting for a sysfs reader to time it out.
+ */
+static int bmp180_start(struct bmp180_prv *prv)
+{
+	int ret;
+
+	if (prv->dead)
+		return -ENODEV;
+	if (prv->state != BMP180_IDLE) {
+		if (ktime_us_delta(ktime_get(), prv->started) <=
+		    BMP180_TEMP_US + bmp180_pres_us[3] +
+		    bmp180_timeout * USEC_PER_MSEC)
+			return 0;
+		pr_err("%s: conversion timed out, restarting\n", __func__);
+		hrtimer_try_to_cancel(&prv->timer);
+		bmp180_finish(prv, -ETIMEDOUT);
+	}
+	ret = bmp180_write_value(prv->client, BMP180_CTR, En_Temp_M);
+	if (ret < 0)
+		return ret;
+	prv->raw.oss = prv->oss;
+	prv->started = ktime_get();
+	prv->state = BMP180_TEMP;
+	bmp180_arm(prv, BMP180_TEMP_US);
+	return 0;
+}
+
+/* Called with prv->lock held, prv->last just completed */
+static void bmp180_emit(struct bmp180_prv *prv)
+{
+	struct bmp180_reader *rd;
+	struct bmp180_record rec = {
+		.timestamp = ktime_to_ns(prv->last.timestamp),
+		.temp      = prv->last.temp,
+		.pressure  = prv->last.pressure,
+		.altitude  = prv->last.altitude,
+		.seq       = prv->count++,
+	};
+
+	if (list_empty(&prv->readers))
+		return;
+	/* A full queue keeps its older records, the reader sees a seq gap */
+	list_for_each_entry(rd, &prv->readers, node)
+		kfifo_put(&rd->fifo, rec);
+	wake_up_interruptible(&prv->rec_wait);
 }
+
+static void bmp180_work(struct work_struct *work)
+{
+	struct bmp180_prv *prv = container_of(work, struct bmp180_prv, work);
+	struct i2c_client *client = prv->client;
+	u8 data[3];
+	int ret;
+
+	mutex_lock(&prv->lock);
+	switch (prv->state) {
+	case BMP180_TEMP:
+		ret = i2c_smbus_read_i2c_block_data(client, UT, 2, data);
+		if (ret != 2)
+			break;
+		prv->raw.ut = get_unaligned_be16(data);
+		ret = bmp180_write_value(client, BMP180_CTR,
+					 En_Pres_M_0 | prv->raw.oss << 6);
+		if (ret < 0)
+			break;
+		prv->state = BMP180_PRES;
+		bmp180_arm(prv, bmp180_pres_us[prv->raw.oss]);
+		mutex_unlock(&prv->lock);
+		return;
+	case BMP180_PRES:
+		ret = i2c_smbus_read_i2c_block_data(client, UP, 3, data);
+		if (ret != 3)
+			break;
+		prv->raw.up = (data[0] << 16 | data[1] << 8 | data[2]) >>
+			      (8 - prv->raw.oss);
+		prv->raw.timestamp = ktime_get();
+		bmp180_compensate(&prv->calib, &prv->raw, &prv->last);
+		prv->last.altitude = bmp180_altitude(prv->last.pressure,
+						     prv->sea_level);
+		prv->last.timestamp = prv->raw.timestamp;
+		prv->valid = true;
+		bmp180_emit(prv);
+		ret = 0;
+		break;
+	default:
+		/* Stale timer or EOC edge after a reset */
+		mutex_unlock(&prv->lock);
+		return;
+	}
+	if (ret > 0)
+		ret = -EIO;
+	if (ret)
+		pr_err("%s: Read error %d\n", __func__, ret);
+	bmp180_finish(prv, ret);
+	mutex_unlock(&prv->lock);
+}
+
+static enum hrtimer_restart bmp180_timer(struct hrtimer *timer)
+{
+	struct bmp180_prv *prv = container_of(timer, struct bmp180_prv, timer);
+
+	schedule_work(&prv->work);
+	return HRTIMER_NORESTART;
+}
+
+static irqreturn_t bmp180_eoc_irq(int irq, void *dev_id)
+{
+	struct bmp180_prv *prv = dev_id;
+
+	schedule_work(&prv->work);
+	return IRQ_HANDLED;
+}
+
+/* Start or join a measurement and wait for its result */
+static int bmp180_measure(struct bmp180_prv *prv, struct bmp180_reading *r)
+{
+	unsigned int seq;
+	long left;
+	int ret;
+
+	mutex_lock(&prv->lock);
+	seq = prv->seq;
+	ret = bmp180_start(prv);
+	mutex_unlock(&prv->lock);
+	if (ret)
+		return ret;
+
+	left = wait_event_interruptible_timeout(prv->wait,
+			READ_ONCE(prv->seq) != seq,
+			usecs_to_jiffies(BMP180_TEMP_US + bmp180_pres_us[3]) +
+			msecs_to_jiffies(bmp180_timeout));
+	if (left < 0)
+		return left;
+
+	mutex_lock(&prv->lock);
+	if (prv->seq == seq) {
+		/* Lost EOC edge or a wedged bus : reset for the next reader */
+		hrtimer_try_to_cancel(&prv->timer);
+		bmp180_finish(prv, -ETIMEDOUT);
+	}
+	ret = prv->err;
+	if (!ret)
+		*r = prv->last;
+	mutex_unlock(&prv->lock);
+	return ret;
+}
+
+/* The last measurement if it is at most @max_age_ms old, a new one else */
+static int bmp180_read(struct bmp180_prv *prv, unsigned int max_age_ms,
+		       struct bmp180_reading *r)
+{
+	bool fresh;
+
+	mutex_lock(&prv->lock);
+	fresh = prv->valid && max_age_ms &&
+		ktime_to_ms(ktime_sub(ktime_get(), prv->last.timestamp)) <=
+		max_age_ms;
+	if (fresh)
+		*r = prv->last;
+	mutex_unlock(&prv->lock);
+	if (fresh)
+		return 0;
+	return bmp180_measure(prv, r);
+}
+
+static void bmp180_sample_work(struct work_struct *work)
+{
+	struct bmp180_prv *prv = container_of(to_delayed_work(work),
+					      struct bmp180_prv, sample_work);
+	unsigned int interval;
+	int ret;
+
+	mutex_lock(&prv->lock);
+	/* Still busy from the last tick : that one becomes this sample */
+	ret = bmp180_start(prv);
+	interval = prv->dead ? 0 : prv->interval_ms;
+	mutex_unlock(&prv->lock);
+	if (ret && ret != -ENODEV)
+		pr_err("%s: conversion start failed %d\n", __func__, ret);
+	if (interval)
+		schedule_delayed_work(&prv->sample_work,
+				      msecs_to_jiffies(interval));
+}
+
+static int bmp180_get_reading(struct kobject *kobj, struct bmp180_reading *r)
+{
+	struct bmp180_prv *prv = bmp180_from_kobj(kobj);
+
+	if (!prv)
+		return -ENODEV;
+	return bmp180_read(prv, READ_ONCE(prv->max_age_ms), r);
+}
+
 static ssize_t bmp180_get_pressure(struct kobject *kobj, 
 				struct kobj_attribute *attr,char *buf)
 {
-	long temp,pressure,pressure1,altitude,pres;
-	long X1,X2,X3,B3,B4,B5,B6,B7,cTemp,fTemp;
-	/* Calibration Cofficients stored in EEPROM of the device 
-	 * Read 22 bytes of data from address 0xAA(170) */
-	get_Calibration_coeff(&prv->client_prv);
-	/* Callibration for Temperature */
-	temp=get_temp_value(&prv->client_prv);
-	X1 = (temp - AC6) * AC5 / 32768.0;
-	X2 = (MC * 2048.0) / (X1 + MD);
-	B5 = X1 + X2;
-	cTemp = ((B5 + 8.0) / 16.0) / 10.0;
-	fTemp = cTemp * 1.8 + 32;
-	/* Calibration for Pressure */
-	pres=get_pressure_value(&prv->client_prv);
-	B6 = B5 - 4000;
-	X1 = (B2 * (B6 * B6 / 4096.0)) / 2048.0;
-	X2 = AC2 * B6 / 2048.0;
-	X3 = X1 + X2;
-	B3 = (((AC1 * 4 + X3) * 2) + 2) / 4.0;
-	X1 = AC3 * B6 / 8192.0;
-	X2 = (B1 * (B6 * B6 / 2048.0)) / 65536.0;
-	X3 = ((X1 + X2) + 2) / 4.0;
-	B4 = AC4 * (X3 + 32768) / 32768.0;
- 	B7 = ((pres - B3) * (25000.0));
-	pressure = 0.0;
-	if(B7 < 2147483648LL){
-		pressure = (B7 * 2) / B4;
-	}else {
-		pressure = (B7 / B4) * 2;
-	}
-	X1 = (pressure / 256.0) * (pressure / 256.0);
-	X1 = (X1 * 3038.0) / 65536.0;
-	X2 = ((-7357) * pressure) / 65536.0;
-	pressure1 = (pressure + (X1 + X2 + 3791) / 16.0) / 100;
-	// Calculate Altitude
-	altitude = 44330 * (1 - power(pressure1/1013.25, 0.1903));
-	return sprintf(buf, "Pressure : %ld\n",pressure1);
+	struct bmp180_reading r;
+	int ret;
+
+	ret = bmp180_get_reading(kobj, &r);
+	if (ret)
+		return ret;
+	/* hPa */
+	return sprintf(buf, "Pressure : %d.%02d\n", r.pressure / 100,
+		       r.pressure % 100);
 }
 
 static ssize_t bmp180_get_altitude(struct kobject *kobj, 
 					struct kobj_attribute *attr,char *buf)
 {
-	long temp,pressure,pressure1,altitude,pres;
-	long X1,X2,X3,B3,B4,B5,B6,B7,cTemp,fTemp;
-	/* Calibration Cofficients stored in EEPROM of the device 
-	 * Read 22 bytes of data from address 0xAA(170) */
-	get_Calibration_coeff(&prv->client_prv);
-	/* Callibration for Temperature */
-	temp=get_temp_value(&prv->client_prv);
-	X1 = (temp - AC6) * AC5 / 32768.0;
-	X2 = (MC * 2048.0) / (X1 + MD);
-	B5 = X1 + X2;
-	cTemp = ((B5 + 8.0) / 16.0) / 10.0;
-	fTemp = cTemp * 1.8 + 32;
-	/* Calibration for Pressure */
-	pres=get_pressure_value(&prv->client_prv);
-	B6 = B5 - 4000;
-	X1 = (B2 * (B6 * B6 / 4096.0)) / 2048.0;
-	X2 = AC2 * B6 / 2048.0;
-	X3 = X1 + X2;
-	B3 = (((AC1 * 4 + X3) * 2) + 2) / 4.0;
-	X1 = AC3 * B6 / 8192.0;
-	X2 = (B1 * (B6 * B6 / 2048.0)) / 65536.0;
-	X3 = ((X1 + X2) + 2) / 4.0;
-	B4 = AC4 * (X3 + 32768) / 32768.0;
- 	B7 = ((pres - B3) * (25000.0));
-	pressure = 0.0;
-	if(B7 < 2147483648LL){
-		pressure = (B7 * 2) / B4;
-	}else {
-		pressure = (B7 / B4) * 2;
-	}
-	X1 = (pressure / 256.0) * (pressure / 256.0);
-	X1 = (X1 * 3038.0) / 65536.0;
-	X2 = ((-7357) * pressure) / 65536.0;
-	pressure1 = (pressure + (X1 + X2 + 3791) / 16.0) / 100;
-	// Calculate Altitude
-	altitude = 44330 * (1 - power(pressure1/1013.25, 0.1903));
-	return sprintf(buf, "Pressure : %ld\n",altitude);
+	struct bmp180_reading r;
+	int ret;
+
+	ret = bmp180_get_reading(kobj, &r);
+	if (ret)
+		return ret;
+	/* m */
+	return sprintf(buf, "Altitude : %s%d.%02d\n", r.altitude < 0 ? "-" : "",
+		       abs(r.altitude) / 100, abs(r.altitude) % 100);
 }
 static ssize_t bmp180_get_cTemp(struct kobject *kobj, 
 				struct kobj_attribute *attr,char *buf)
 {
-	long temp;
-	long X1,X2,B5,cTemp,fTemp;
-	/* Calibration Cofficients stored in EEPROM of the device 
-	 * Read 22 bytes of data from address 0xAA(170) */
-	get_Calibration_coeff(&prv->client_prv);
-	/* Callibration for Temperature */
-	temp=get_temp_value(&prv->client_prv);
-	X1 = (temp - AC6) * AC5 / 32768.0;
-	X2 = (MC * 2048.0) / (X1 + MD);
-	B5 = X1 + X2;
-	cTemp = ((B5 + 8.0) / 16.0) / 10.0;
-	fTemp = cTemp * 1.8 + 32;
-	return sprintf(buf, "Temperature in Celsius : %ld\n",cTemp);
+	struct bmp180_reading r;
+	int ret;
+
+	ret = bmp180_get_reading(kobj, &r);
+	if (ret)
+		return ret;
+	return sprintf(buf, "Temperature in Celsius : %s%d.%d\n",
+		       r.temp < 0 ? "-" : "", abs(r.temp) / 10, abs(r.temp) % 10);
 }
 static ssize_t bmp180_get_fTemp(struct kobject *kobj, 
 				struct kobj_attribute *attr,char *buf)
 {
-	long temp;
-	long X1,X2,B5,cTemp,fTemp;
-	/* Calibration Cofficients stored in EEPROM of the devicei*/ 
-	 /* Read 22 bytes of data from address 0xAA(170) */
-	get_Calibration_coeff(&prv->client_prv);
-	/* Callibration for Temperature */
-	temp=get_temp_value(&prv->client_prv);
-	X1 = (temp - AC6) * AC5 / 32768.0;
-	X2 = (MC * 2048.0) / (X1 + MD);
-	B5 = X1 + X2;
-	cTemp = ((B5 + 8.0) / 16.0) / 10.0;
-	fTemp = cTemp * 1.8 + 32;
-	return sprintf(buf, "Temperature in  Fahrenheit : %ld\n",fTemp);
+	struct bmp180_reading r;
+	int ret, f;
+
+	ret = bmp180_get_reading(kobj, &r);
+	if (ret)
+		return ret;
+	/* 0.1 F */
+	f = r.temp * 9 / 5 + 320;
+	return sprintf(buf, "Temperature in  Fahrenheit : %s%d.%d\n",
+		       f < 0 ? "-" : "", abs(f) / 10, abs(f) % 10);
+}
+
+/* Sea level reference for Altitude, Pa */
+static ssize_t bmp180_sea_level_show(struct kobject *kobj,
+				     struct kobj_attribute *attr, char *buf)
+{
+	struct bmp180_prv *prv = bmp180_from_kobj(kobj);
+
+	if (!prv)
+		return -ENODEV;
+	return sprintf(buf, "%u\n", READ_ONCE(prv->sea_level));
+}
+
+static ssize_t bmp180_sea_level_store(struct kobject *kobj,
+				      struct kobj_attribute *attr,
+				      const char *buf, size_t count)
+{
+	struct bmp180_prv *prv = bmp180_from_kobj(kobj);
+	unsigned int val;
+	int ret;
+
+	if (!prv)
+		return -ENODEV;
+	ret = kstrtouint(buf, 0, &val);
+	if (ret)
+		return ret;
+	if (val < 30000 || val > 120000)
+		return -EINVAL;
+	mutex_lock(&prv->lock);
+	prv->sea_level = val;
+	if (prv->valid)
+		prv->last.altitude = bmp180_altitude(prv->last.pressure, val);
+	mutex_unlock(&prv->lock);
+	return count;
 }
+
+/* Timestamp (ns, CLOCK_MONOTONIC), 0.1 C, Pa and cm from one measurement */
+static ssize_t bmp180_get_snapshot(struct kobject *kobj,
+				   struct kobj_attribute *attr, char *buf)
+{
+	struct bmp180_reading r;
+	int ret;
+
+	ret = bmp180_get_reading(kobj, &r);
+	if (ret)
+		return ret;
+	return sprintf(buf, "%lld %d %d %d\n", ktime_to_ns(r.timestamp),
+		       r.temp, r.pressure, r.altitude);
+}
+
+/* Sampling configuration : Oss, Sample_interval_ms and Max_age_ms */
+enum { BMP180_CFG_OSS, BMP180_CFG_INTERVAL, BMP180_CFG_MAX_AGE };
+
+static ssize_t bmp180_cfg_show(struct kobject *kobj, struct kobj_attribute *attr,
+			       char *buf, int which)
+{
+	struct bmp180_prv *prv = bmp180_from_kobj(kobj);
+	unsigned int val;
+
+	if (!prv)
+		return -ENODEV;
+	mutex_lock(&prv->lock);
+	switch (which) {
+	case BMP180_CFG_OSS:
+		val = prv->oss;
+		break;
+	case BMP180_CFG_INTERVAL:
+		val = prv->interval_ms;
+		break;
+	default:
+		val = prv->max_age_ms;
+		break;
+	}
+	mutex_unlock(&prv->lock);
+	return sprintf(buf, "%u\n", val);
+}
+
+static ssize_t bmp180_cfg_store(struct kobject *kobj, struct kobj_attribute *attr,
+				const char *buf, size_t count, int which)
+{
+	struct bmp180_prv *prv = bmp180_from_kobj(kobj);
+	unsigned int val;
+	int ret;
+
+	if (!prv)
+		return -ENODEV;
+	ret = kstrtouint(buf, 0, &val);
+	if (ret)
+		return ret;
+	switch (which) {
+	case BMP180_CFG_OSS:
+		if (val > 3)
+			return -EINVAL;
+		mutex_lock(&prv->lock);
+		prv->oss = val;
+		mutex_unlock(&prv->lock);
+		break;
+	case BMP180_CFG_INTERVAL:
+		/* One measurement takes up to 30 ms at OSS 3 */
+		if (val && (val < 40 || val > 3600000))
+			return -EINVAL;
+		mutex_lock(&prv->lock);
+		prv->interval_ms = val;
+		mutex_unlock(&prv->lock);
+		if (val)
+			mod_delayed_work(system_wq, &prv->sample_work, 0);
+		else
+			cancel_delayed_work_sync(&prv->sample_work);
+		break;
+	default:
+		mutex_lock(&prv->lock);
+		prv->max_age_ms = val;
+		mutex_unlock(&prv->lock);
+		break;
+	}
+	return count;
+}
+
+#define BMP180_CFG_ATTR(_name, _which)					\
+static ssize_t _name##_show(struct kobject *kobj,			\
+			    struct kobj_attribute *attr, char *buf)	\
+{									\
+	return bmp180_cfg_show(kobj, attr, buf, _which);		\
+}									\
+static ssize_t _name##_store(struct kobject *kobj,			\
+			     struct kobj_attribute *attr,		\
+			     const char *buf, size_t count)		\
+{									\
+	return bmp180_cfg_store(kobj, attr, buf, count, _which);	\
+}
+
+BMP180_CFG_ATTR(bmp180_oss, BMP180_CFG_OSS)
+BMP180_CFG_ATTR(bmp180_interval, BMP180_CFG_INTERVAL)
+BMP180_CFG_ATTR(bmp180_max_age, BMP180_CFG_MAX_AGE)
+
 static struct kobj_attribute pressure  = __ATTR(Pressure, 0444, bmp180_get_pressure,NULL);
 static struct kobj_attribute altitude  = __ATTR(Altitude, 0444, bmp180_get_altitude,NULL);
 static struct kobj_attribute cTemp     = __ATTR(Temp_in_Cel, 0444, bmp180_get_cTemp,NULL);
 static struct kobj_attribute fTemp     = __ATTR(Temp_in_Fah, 0444, bmp180_get_fTemp,NULL);
+static struct kobj_attribute sea_level = __ATTR(Sea_level_Pa, 0644, bmp180_sea_level_show,
+						bmp180_sea_level_store);
+static struct kobj_attribute snapshot  = __ATTR(Snapshot, 0444, bmp180_get_snapshot, NULL);
+static struct kobj_attribute oss       = __ATTR(Oss, 0644, bmp180_oss_show, bmp180_oss_store);
+static struct kobj_attribute interval  = __ATTR(Sample_interval_ms, 0644, bmp180_interval_show,
+						bmp180_interval_store);
+static struct kobj_attribute max_age   = __ATTR(Max_age_ms, 0644, bmp180_max_age_show,
+						bmp180_max_age_store);
 
 static struct attribute *attrs[] = {
         &pressure.attr,
         &altitude.attr,
         &cTemp.attr,
         &fTemp.attr,
+        &sea_level.attr,
+        &snapshot.attr,
+        &oss.attr,
+        &interval.attr,
+        &max_age.attr,
         NULL,
 };
 
@@ -294,9 +761,150 @@ static struct attribute_group attr_group = {
 };
 
 
+/*
+ * /dev/bmp180-<bus>-<addr> : binary records (bmp180_record.h), one per completed
+ * measurement, queued separately for every open file so each reader sees
+ * the whole sequence. Opening does not start sampling, Sample_interval_ms
+ * sets the record rate.
+ */
+static void bmp180_release_prv(struct kref *ref)
+{
+	kfree(container_of(ref, struct bmp180_prv, ref));
+}
+
+static int bmp180_rec_open(struct inode *inode, struct file *filp)
+{
+	struct bmp180_prv *prv = container_of(inode->i_cdev,
+					      struct bmp180_prv, cdev);
+	struct bmp180_reader *rd;
+
+	rd = kzalloc(sizeof(*rd), GFP_KERNEL);
+	if (!rd)
+		return -ENOMEM;
+	INIT_KFIFO(rd->fifo);
+	mutex_init(&rd->read_lock);
+	rd->prv = prv;
+
+	mutex_lock(&prv->lock);
+	if (prv->dead) {
+		mutex_unlock(&prv->lock);
+		kfree(rd);
+		return -ENODEV;
+	}
+	kref_get(&prv->ref);
+	list_add_tail(&rd->node, &prv->readers);
+	mutex_unlock(&prv->lock);
+
+	filp->private_data = rd;
+	return nonseekable_open(inode, filp);
+}
+
+static int bmp180_rec_release(struct inode *inode, struct file *filp)
+{
+	struct bmp180_reader *rd = filp->private_data;
+	struct bmp180_prv *prv = rd->prv;
+
+	mutex_lock(&prv->lock);
+	list_del(&rd->node);
+	mutex_unlock(&prv->lock);
+	kfree(rd);
+	kref_put(&prv->ref, bmp180_release_prv);
+	return 0;
+}
+
+static ssize_t bmp180_rec_read(struct file *filp, char __user *buf,
+			       size_t count, loff_t *ppos)
+{
+	struct bmp180_reader *rd = filp->private_data;
+	struct bmp180_prv *prv = rd->prv;
+	unsigned int copied;
+	int ret;
+
+	if (count < sizeof(struct bmp180_record))
+		return -EINVAL;
+	if (kfifo_is_empty(&rd->fifo)) {
+		if (READ_ONCE(prv->dead))
+			return 0;
+		if (filp->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		ret = wait_event_interruptible(prv->rec_wait,
+					       !kfifo_is_empty(&rd->fifo) ||
+					       READ_ONCE(prv->dead));
+		if (ret)
+			return ret;
+	}
+	if (mutex_lock_interruptible(&rd->read_lock))
+		return -ERESTARTSYS;
+	ret = kfifo_to_user(&rd->fifo, buf, count, &copied);
+	mutex_unlock(&rd->read_lock);
+
+	return ret ? ret : copied;
+}
+
+static unsigned int bmp180_rec_poll(struct file *filp, poll_table *wait)
+{
+	struct bmp180_reader *rd = filp->private_data;
+	struct bmp180_prv *prv = rd->prv;
+	unsigned int mask = 0;
+
+	poll_wait(filp, &prv->rec_wait, wait);
+	if (!kfifo_is_empty(&rd->fifo))
+		mask |= POLLIN | POLLRDNORM;
+	if (READ_ONCE(prv->dead))
+		mask |= POLLHUP;
+	return mask;
+}
+
+static const struct file_operations bmp180_rec_fops = {
+	.owner   = THIS_MODULE,
+	.open    = bmp180_rec_open,
+	.release = bmp180_rec_release,
+	.read    = bmp180_rec_read,
+	.poll    = bmp180_rec_poll,
+	.llseek  = no_llseek,
+};
+
+static int bmp180_rec_init(struct bmp180_prv *prv, const char *name)
+{
+	struct device *dev;
+	int minor, ret;
+
+	minor = ida_simple_get(&bmp180_minors, 0, BMP180_MAX_CHIPS, GFP_KERNEL);
+	if (minor < 0)
+		return minor;
+	prv->devt = MKDEV(MAJOR(bmp180_devt), minor);
+	cdev_init(&prv->cdev, &bmp180_rec_fops);
+	prv->cdev.owner = THIS_MODULE;
+	ret = cdev_add(&prv->cdev, prv->devt, 1);
+	if (ret)
+		goto err_minor;
+	dev = device_create(bmp180_class, &prv->client->dev, prv->devt, NULL,
+			    "%s", name);
+	if (IS_ERR(dev)) {
+		ret = PTR_ERR(dev);
+		goto err_cdev;
+	}
+	return 0;
+
+err_cdev:
+	cdev_del(&prv->cdev);
+err_minor:
+	ida_simple_remove(&bmp180_minors, minor);
+	return ret;
+}
+
+static void bmp180_rec_exit(struct bmp180_prv *prv)
+{
+	device_destroy(bmp180_class, prv->devt);
+	cdev_del(&prv->cdev);
+	ida_simple_remove(&bmp180_minors, MINOR(prv->devt));
+}
+
 static int bmp180_probe(struct i2c_client *client, 
 				const struct i2c_device_id *id)
 {
+	struct bmp180_prv *prv;
+	char name[32];
 	int ret;
 	pr_info("%s: Device bmp180 probed......\n",__func__);	
 	prv=(struct bmp180_prv *)kzalloc(sizeof(struct bmp180_prv), GFP_KERNEL);		
@@ -304,23 +912,91 @@ static int bmp180_probe(struct i2c_client *client,
 		pr_info("Requested memory not allocated\n");
 		return -ENOMEM;
 	}
-	prv->client_prv = *client;
+	prv->client = client;
+	prv->oss = 1;
+	prv->sea_level = 101325;
+	prv->max_age_ms = 1000;
+	INIT_DELAYED_WORK(&prv->sample_work, bmp180_sample_work);
+	kref_init(&prv->ref);
+	INIT_LIST_HEAD(&prv->readers);
+	init_waitqueue_head(&prv->rec_wait);
+	mutex_init(&prv->lock);
+	init_waitqueue_head(&prv->wait);
+	INIT_WORK(&prv->work, bmp180_work);
+	hrtimer_init(&prv->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	prv->timer.function = bmp180_timer;
+	ret = bmp180_read_calib(client, &prv->calib);
+	if (ret) {
+		dev_err(&client->dev, "calibration read failed %d\n", ret);
+		goto err_free;
+	}
+	/* EOC is optional, without it the hrtimer paces the stages */
+	if (client->irq > 0) {
+		ret = devm_request_irq(&client->dev, client->irq, bmp180_eoc_irq,
+				       0, "bmp180", prv);
+		if (ret) {
+			dev_err(&client->dev, "EOC irq %d failed %d\n",
+				client->irq, ret);
+			goto err_free;
+		}
+	}
 	
-	prv->bmp180_kobj=kobject_create_and_add("bmp180", NULL);
-	if(!prv->bmp180_kobj)
-		return -ENOMEM;
+	/* /sys/bmp180-<bus>-<addr> and /dev/bmp180-<bus>-<addr> */
+	snprintf(name, sizeof(name), "bmp180-%d-%02x",
+		 client->adapter->nr, client->addr);
+	prv->bmp180_kobj=kobject_create_and_add(name, NULL);
+	if(!prv->bmp180_kobj){
+		ret = -ENOMEM;
+		goto err_irq;
+	}
 
 	ret= sysfs_create_group(prv->bmp180_kobj, &attr_group);
 	if(ret)
-		kobject_put(prv->bmp180_kobj);
-	
+		goto err_kobj;
+	ret = bmp180_rec_init(prv, name);
+	if (ret) {
+		dev_err(&client->dev, "/dev/%s setup failed %d\n", name, ret);
+		goto err_kobj;
+	}
+	i2c_set_clientdata(client, prv);
+
+	mutex_lock(&bmp180_chips_lock);
+	list_add_tail(&prv->node, &bmp180_chips);
+	mutex_unlock(&bmp180_chips_lock);
 	return 0;
+err_kobj:
+	kobject_put(prv->bmp180_kobj);
+err_irq:
+	if (client->irq > 0)
+		devm_free_irq(&client->dev, client->irq, prv);
+err_free:
+	kfree(prv);
+	return ret;
 }
 static int bmp180_remove(struct i2c_client *client)
 {
+	struct bmp180_prv *prv = i2c_get_clientdata(client);
+
 	pr_info("bmp180_remove\n");
-	kfree(prv);
+	mutex_lock(&bmp180_chips_lock);
+	list_del(&prv->node);
+	mutex_unlock(&bmp180_chips_lock);
+	/* Fail new readers, release waiting ones, then quiesce the engine */
+	mutex_lock(&prv->lock);
+	prv->dead = true;
+	if (prv->state != BMP180_IDLE)
+		bmp180_finish(prv, -ENODEV);
+	mutex_unlock(&prv->lock);
+	wake_up_interruptible(&prv->rec_wait);
+	bmp180_rec_exit(prv);
 	kobject_put(prv->bmp180_kobj);
+	cancel_delayed_work_sync(&prv->sample_work);
+	if (client->irq > 0)
+		devm_free_irq(&client->dev, client->irq, prv);
+	hrtimer_cancel(&prv->timer);
+	cancel_work_sync(&prv->work);
+	/* Open record files keep prv until they are closed */
+	kref_put(&prv->ref, bmp180_release_prv);
 	return 0;
 }
 
@@ -339,15 +1015,41 @@ static struct i2c_driver bmp180_drv = {
 	.id_table = bmp180_ids,
 };
 
-/**
- * module_i2c_driver() - Helper macro for registering a modular I2C driver
- * @__i2c_driver: i2c_driver struct
- *
- * Helper macro for I2C drivers which do not do anything special in module
- * init/exit. This eliminates a lot of boilerplate. Each module may only
- * use this macro once, and calling it replaces module_init() and module_exit()
- */
-module_i2c_driver(bmp180_drv);
+/* The record device region and class outlive every chip, so no module_i2c_driver() */
+static int __init bmp180_init(void)
+{
+	int ret;
+
+	ret = alloc_chrdev_region(&bmp180_devt, 0, BMP180_MAX_CHIPS, "bmp180");
+	if (ret)
+		return ret;
+	bmp180_class = class_create(THIS_MODULE, "bmp180");
+	if (IS_ERR(bmp180_class)) {
+		ret = PTR_ERR(bmp180_class);
+		goto err_region;
+	}
+	ret = i2c_add_driver(&bmp180_drv);
+	if (ret)
+		goto err_class;
+	return 0;
+
+err_class:
+	class_destroy(bmp180_class);
+err_region:
+	unregister_chrdev_region(bmp180_devt, BMP180_MAX_CHIPS);
+	return ret;
+}
+
+static void __exit bmp180_exit(void)
+{
+	i2c_del_driver(&bmp180_drv);
+	class_destroy(bmp180_class);
+	unregister_chrdev_region(bmp180_devt, BMP180_MAX_CHIPS);
+	ida_destroy(&bmp180_minors);
+}
+
+module_init(bmp180_init);
+module_exit(bmp180_exit);
 
 
 MODULE_DESCRIPTION("Driver for BMP180 I2c pressure sensor");
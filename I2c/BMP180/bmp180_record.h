@@ -0,0 +1,27 @@
+#ifndef _BMP180_RECORD_H_
+#define _BMP180_RECORD_H_
+
+/*
+ * Record format of /dev/bmp180-<bus>-<addr>. Included by the driver and by
+ * userspace readers.
+ *
+ * Every completed measurement (periodic sampling, see Sample_interval_ms,
+ * or one triggered by a sysfs read) is appended to each open file. read()
+ * returns as many whole records as fit in the buffer and blocks while
+ * there are none, poll() reports POLLIN when at least one is queued.
+ * A reader that falls behind by more than BMP180_RECORD_QUEUE records
+ * loses the newest ones; seq jumps by the number lost.
+ */
+#include <linux/types.h>
+
+#define BMP180_RECORD_QUEUE	64
+
+struct bmp180_record {
+	__s64 timestamp;	/* ns, CLOCK_MONOTONIC, end of conversion */
+	__s32 temp;		/* 0.1 C */
+	__s32 pressure;		/* Pa */
+	__s32 altitude;		/* cm above the Sea_level_Pa reference */
+	__u32 seq;		/* completed measurements since probe */
+};
+
+#endif /* _BMP180_RECORD_H_ */
@@ -5,23 +5,78 @@
 #include <linux/i2c.h>
 #include <linux/jiffies.h>
 #include <linux/delay.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/bcd.h>
+#include <linux/rtc.h>
+#include <linux/interrupt.h>
+#include <linux/seqlock.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/pm.h>
+#include <linux/pm_wakeup.h>
 
 
 enum DS3231_reg {
 	SEC		= 0x00,
 	MIN		= 0x01,
 	HOUR		= 0x02,
+	DAY		= 0x03,
 	DATE		= 0x04,
+	MONTH		= 0x05,		/* bit 7 : century */
+	YEAR		= 0x06,
+	A1SEC		= 0x07,		/* alarm 1 : SEC MIN HOUR DAY/DATE */
+	A2MIN		= 0x0B,		/* alarm 2 : MIN HOUR DAY/DATE */
+	CONTROL		= 0x0E,
+	STATUS		= 0x0F,
 };
 
+#define DS3231_TIME_LEN		7	/* SEC .. YEAR */
+#define DS3231_A1_LEN		4
+#define DS3231_A2_LEN		3
+
+/* HOUR */
+#define DS3231_HOUR_12		(1 << 6)
+#define DS3231_HOUR_PM		(1 << 5)
+/* MONTH */
+#define DS3231_CENTURY		(1 << 7)
+/* Alarm registers : bit 7 masks the field out of the match */
+#define DS3231_AxMx		(1 << 7)
+/* CONTROL */
+#define DS3231_A1IE		(1 << 0)
+#define DS3231_A2IE		(1 << 1)
+#define DS3231_INTCN		(1 << 2)	/* 0 : square wave on INT/SQW */
+#define DS3231_RS_MASK		(3 << 3)	/* 00 : 1 Hz */
+/* STATUS */
+#define DS3231_OSF		(1 << 7)	/* oscillator stopped, time invalid */
+#define DS3231_A1F		(1 << 0)
+#define DS3231_A2F		(1 << 1)
+
 struct ds3231_prv {
-	struct i2c_client client_prv;
+	struct i2c_client *client;
 	struct kobject *ds3231_kobj;
+	struct rtc_device *rtc;
+	struct mutex lock;		/* multi register updates */
+	struct list_head node;
+
+	/*
+	 * 1 Hz SQW time cache : RTC seconds and the CLOCK_MONOTONIC time of
+	 * the edge that started them. Readers interpolate under the seqlock.
+	 */
+	bool sqw;			/* mode on, under lock */
+	seqlock_t cache_lock;
+	bool cache_valid;
+	unsigned int cache_gen;		/* bumped by every invalidate */
+	time64_t cache_sec;
+	ktime_t cache_edge;
+	ktime_t edge;			/* hard IRQ -> thread */
+
+	bool irq_wake;			/* enable_irq_wake() done in suspend */
 };
 
-struct ds3231_prv *prv=NULL;
+static LIST_HEAD(ds3231_chips);
+static DEFINE_MUTEX(ds3231_chips_lock);
 
-static unsigned ds3231_timeout = 25; /*default timeout for normal I2c  devices */
 /* register access */
 
 static int ds3231_read_value(struct i2c_client *client, u8 reg)
@@ -30,55 +85,530 @@ static int ds3231_read_value(struct i2c_client *client, u8 reg)
 
 }
 
-static ssize_t 
-ds3231_date_get(struct kobject *kobj, struct kobj_attribute *attr,char *buf)
+static int ds3231_write_value(struct i2c_client *client, u8 reg, u8 value)
 {
-	char date;
-	unsigned long timeout, read_time;
-	timeout = jiffies + msecs_to_jiffies(ds3231_timeout);
-	do{
-		read_time = jiffies;
-		date = ds3231_read_value(&prv->client_prv,DATE); 
-		if (date < 0 )
-			pr_err("Read error\n");
-		else{
-			return sprintf(buf, "Date : %d\n",date);
+	return i2c_smbus_write_byte_data(client, reg, value);
+}
+
+static struct ds3231_prv *ds3231_from_kobj(struct kobject *kobj)
+{
+	struct ds3231_prv *prv, *found = NULL;
+
+	mutex_lock(&ds3231_chips_lock);
+	list_for_each_entry(prv, &ds3231_chips, node) {
+		if (prv->ds3231_kobj == kobj) {
+			found = prv;
+			break;
 		}
-		msleep(1);
+	}
+	mutex_unlock(&ds3231_chips_lock);
+	return found;
+}
+
+/*
+ * SEC .. YEAR in one combined write/read transfer : the DS3231 copies the
+ * counters to its user buffer on START, so the 7 bytes never straddle a
+ * seconds rollover the way separate byte reads can.
+ */
+static void ds3231_regs_to_tm(const u8 *regs, struct rtc_time *tm)
+{
+	u8 hour = regs[HOUR];
+
+	tm->tm_sec = bcd2bin(regs[SEC] & 0x7F);
+	tm->tm_min = bcd2bin(regs[MIN] & 0x7F);
+	if (hour & DS3231_HOUR_12) {
+		tm->tm_hour = bcd2bin(hour & 0x1F) % 12;
+		if (hour & DS3231_HOUR_PM)
+			tm->tm_hour += 12;
+	} else {
+		tm->tm_hour = bcd2bin(hour & 0x3F);
+	}
+	tm->tm_wday = (regs[DAY] & 0x07) - 1;
+	tm->tm_mday = bcd2bin(regs[DATE] & 0x3F);
+	tm->tm_mon = bcd2bin(regs[MONTH] & 0x1F) - 1;
+	/* 2000 .. 2199 */
+	tm->tm_year = bcd2bin(regs[YEAR]) + 100 +
+		      (regs[MONTH] & DS3231_CENTURY ? 100 : 0);
+}
+
+/*
+ * 1 Hz SQW mode : with INTCN clear the INT/SQW pin outputs 1 Hz and its
+ * falling edge is the seconds rollover (datasheet: the output goes high
+ * 500 ms after the seconds update). The hard IRQ stamps the edge, the
+ * thread reads the new second once and publishes the pair. Any time
+ * query then costs a seqlock read and a ktime_get(), no bus traffic.
+ * Edges that stop coming (pin reconfigured, missing pull-up) make the
+ * cache stale after two seconds and queries fall back to the bus.
+ */
+#define DS3231_CACHE_MAX_NS	(2 * NSEC_PER_SEC)
+
+static int ds3231_cached_time(struct ds3231_prv *prv, struct timespec64 *ts)
+{
+	unsigned int seq;
+	time64_t sec;
+	s64 elapsed;
+	s32 nsec;
+	bool valid;
+
+	do {
+		seq = read_seqbegin(&prv->cache_lock);
+		valid = prv->cache_valid;
+		sec = prv->cache_sec;
+		elapsed = ktime_to_ns(ktime_sub(ktime_get(), prv->cache_edge));
+	} while (read_seqretry(&prv->cache_lock, seq));
 
-	}while (time_before(read_time, timeout));
-	
-	return -ETIMEDOUT;
+	if (!valid || elapsed < 0 || elapsed > DS3231_CACHE_MAX_NS)
+		return -EAGAIN;
+	ts->tv_sec = sec + div_s64_rem(elapsed, NSEC_PER_SEC, &nsec);
+	ts->tv_nsec = nsec;
 	return 0;
 }
-static ssize_t 
+
+static void ds3231_cache_invalidate(struct ds3231_prv *prv)
+{
+	write_seqlock(&prv->cache_lock);
+	prv->cache_valid = false;
+	prv->cache_gen++;
+	write_sequnlock(&prv->cache_lock);
+}
+
+static int ds3231_get_time(struct ds3231_prv *prv, struct rtc_time *tm)
+{
+	u8 regs[DS3231_TIME_LEN];
+	int ret;
+
+	ret = ds3231_read_value(prv->client, STATUS);
+	if (ret < 0)
+		return ret;
+	if (ret & DS3231_OSF) {
+		dev_warn(&prv->client->dev, "oscillator stopped, time not set\n");
+		return -EINVAL;
+	}
+	ret = i2c_smbus_read_i2c_block_data(prv->client, SEC,
+					    DS3231_TIME_LEN, regs);
+	if (ret < 0)
+		return ret;
+	if (ret != DS3231_TIME_LEN)
+		return -EIO;
+	ds3231_regs_to_tm(regs, tm);
+	return rtc_valid_tm(tm);
+}
+
+static int ds3231_read_time(struct device *dev, struct rtc_time *tm)
+{
+	struct ds3231_prv *prv = dev_get_drvdata(dev);
+	struct timespec64 ts;
+
+	if (!ds3231_cached_time(prv, &ts)) {
+		rtc_time64_to_tm(ts.tv_sec, tm);
+		return 0;
+	}
+	return ds3231_get_time(prv, tm);
+}
+
+static int ds3231_set_time(struct device *dev, struct rtc_time *tm)
+{
+	struct ds3231_prv *prv = dev_get_drvdata(dev);
+	u8 regs[DS3231_TIME_LEN];
+	int ret;
+
+	if (tm->tm_year < 100 || tm->tm_year > 299)
+		return -EINVAL;
+	regs[SEC] = bin2bcd(tm->tm_sec);
+	regs[MIN] = bin2bcd(tm->tm_min);
+	regs[HOUR] = bin2bcd(tm->tm_hour);		/* 24 hour mode */
+	regs[DAY] = tm->tm_wday + 1;
+	regs[DATE] = bin2bcd(tm->tm_mday);
+	regs[MONTH] = bin2bcd(tm->tm_mon + 1) |
+		      (tm->tm_year >= 200 ? DS3231_CENTURY : 0);
+	regs[YEAR] = bin2bcd(tm->tm_year % 100);
+
+	mutex_lock(&prv->lock);
+	/* The cached second is wrong from here until the next edge */
+	ds3231_cache_invalidate(prv);
+	/* Writing SEC resets the countdown chain, the new second starts now */
+	ret = i2c_smbus_write_i2c_block_data(prv->client, SEC,
+					     DS3231_TIME_LEN, regs);
+	/* And an edge read that started before the write must not publish */
+	ds3231_cache_invalidate(prv);
+	if (!ret) {
+		/* The time is valid again */
+		ret = ds3231_read_value(prv->client, STATUS);
+		if (ret >= 0)
+			ret = ds3231_write_value(prv->client, STATUS,
+						 ret & ~DS3231_OSF);
+	}
+	mutex_unlock(&prv->lock);
+	return ret < 0 ? ret : 0;
+}
+
+static irqreturn_t ds3231_irq(int irq, void *dev_id)
+{
+	struct ds3231_prv *prv = dev_id;
+
+	prv->edge = ktime_get();
+	return IRQ_WAKE_THREAD;
+}
+
+/*
+ * Alarm mode (INTCN set) : INT is held low while an enabled AxF flag is
+ * set, so the flags are cleared here or no further edge would arrive.
+ * AxF also sets on a match of a disabled alarm, so only flags whose AxIE
+ * is set count (the bits line up) and only those are cleared.
+ * Alarm 1 goes to the rtc core (one shot, as the match repeats monthly),
+ * alarm 2 is a daily HH:MM match and only wakes Alarm2 pollers.
+ */
+static irqreturn_t ds3231_alarm_irq(struct ds3231_prv *prv)
+{
+	int status, control, fired;
+
+	mutex_lock(&prv->lock);
+	status = ds3231_read_value(prv->client, STATUS);
+	control = ds3231_read_value(prv->client, CONTROL);
+	if (status < 0 || control < 0) {
+		mutex_unlock(&prv->lock);
+		return IRQ_NONE;
+	}
+	fired = status & control & (DS3231_A1IE | DS3231_A2IE);
+	if (!fired) {
+		mutex_unlock(&prv->lock);
+		return IRQ_NONE;
+	}
+	ds3231_write_value(prv->client, STATUS, status & ~fired);
+	if (fired & DS3231_A1F)
+		ds3231_write_value(prv->client, CONTROL,
+				   control & ~DS3231_A1IE);
+	mutex_unlock(&prv->lock);
+
+	if (fired & DS3231_A1F)
+		rtc_update_irq(prv->rtc, 1, RTC_AF | RTC_IRQF);
+	if (fired & DS3231_A2F)
+		sysfs_notify(prv->ds3231_kobj, NULL, "Alarm2");
+	return IRQ_HANDLED;
+}
+
+static irqreturn_t ds3231_irq_thread(int irq, void *dev_id)
+{
+	struct ds3231_prv *prv = dev_id;
+	struct rtc_time tm;
+	ktime_t edge = prv->edge;
+	unsigned int gen;
+	int ret;
+
+	if (!READ_ONCE(prv->sqw))
+		return ds3231_alarm_irq(prv);
+	/* A set_time() racing the read below bumps it, see the publish */
+	gen = READ_ONCE(prv->cache_gen);
+	smp_rmb();
+	ret = ds3231_get_time(prv, &tm);
+	/* A read finishing past the next rollover would pair the wrong second */
+	if (ret || ktime_to_ns(ktime_sub(ktime_get(), edge)) > NSEC_PER_SEC / 2) {
+		ds3231_cache_invalidate(prv);
+		return IRQ_HANDLED;
+	}
+	write_seqlock(&prv->cache_lock);
+	/* The second read may predate a set_time() : wait for the next edge */
+	if (prv->cache_gen == gen) {
+		prv->cache_sec = rtc_tm_to_time64(&tm);
+		prv->cache_edge = edge;
+		prv->cache_valid = true;
+	}
+	write_sequnlock(&prv->cache_lock);
+	return IRQ_HANDLED;
+}
+
+/*
+ * INT/SQW : 1 Hz square wave (on) or interrupt output, idle high (off).
+ * One pin, so the square wave and the alarm interrupts exclude each other.
+ */
+static int ds3231_set_sqw(struct ds3231_prv *prv, bool on)
+{
+	int ret;
+
+	if (prv->client->irq <= 0)
+		return -ENODEV;
+	mutex_lock(&prv->lock);
+	ret = ds3231_read_value(prv->client, CONTROL);
+	if (ret < 0)
+		goto out;
+	if (on && (ret & (DS3231_A1IE | DS3231_A2IE))) {
+		ret = -EBUSY;
+		goto out;
+	}
+	ret &= ~(DS3231_INTCN | DS3231_RS_MASK);
+	if (!on)
+		ret |= DS3231_INTCN;
+	ret = ds3231_write_value(prv->client, CONTROL, ret);
+	if (ret < 0)
+		goto out;
+	WRITE_ONCE(prv->sqw, on);
+	if (!on)
+		ds3231_cache_invalidate(prv);
+out:
+	mutex_unlock(&prv->lock);
+	return ret < 0 ? ret : 0;
+}
+
+/* Set or clear AxIE bits, INTCN stays set in alarm mode */
+static int ds3231_alarm_enable(struct ds3231_prv *prv, u8 mask, bool on)
+{
+	int ret;
+
+	if (prv->client->irq <= 0)
+		return -EINVAL;
+	mutex_lock(&prv->lock);
+	if (prv->sqw) {
+		ret = -EBUSY;
+		goto out;
+	}
+	ret = ds3231_read_value(prv->client, CONTROL);
+	if (ret < 0)
+		goto out;
+	if (on)
+		ret |= mask | DS3231_INTCN;
+	else
+		ret &= ~mask;
+	ret = ds3231_write_value(prv->client, CONTROL, ret);
+out:
+	mutex_unlock(&prv->lock);
+	return ret < 0 ? ret : 0;
+}
+
+static int ds3231_read_alarm(struct device *dev, struct rtc_wkalrm *alrm)
+{
+	struct ds3231_prv *prv = dev_get_drvdata(dev);
+	u8 regs[DS3231_A1_LEN];
+	int control, status, ret;
+
+	ret = i2c_smbus_read_i2c_block_data(prv->client, A1SEC,
+					    DS3231_A1_LEN, regs);
+	if (ret < 0)
+		return ret;
+	if (ret != DS3231_A1_LEN)
+		return -EIO;
+	control = ds3231_read_value(prv->client, CONTROL);
+	if (control < 0)
+		return control;
+	status = ds3231_read_value(prv->client, STATUS);
+	if (status < 0)
+		return status;
+
+	/* Month and year are not matched, the rtc core fills them in */
+	alrm->time.tm_sec = bcd2bin(regs[0] & 0x7F);
+	alrm->time.tm_min = bcd2bin(regs[1] & 0x7F);
+	alrm->time.tm_hour = bcd2bin(regs[2] & 0x3F);
+	alrm->time.tm_mday = bcd2bin(regs[3] & 0x3F);
+	alrm->time.tm_mon = -1;
+	alrm->time.tm_year = -1;
+	alrm->time.tm_wday = -1;
+	alrm->time.tm_yday = -1;
+	alrm->time.tm_isdst = -1;
+	alrm->enabled = !!(control & DS3231_A1IE);
+	alrm->pending = !!(status & DS3231_A1F);
+	return 0;
+}
+
+/* Alarm 1 matching date, hours, minutes and seconds */
+static int ds3231_set_alarm(struct device *dev, struct rtc_wkalrm *alrm)
+{
+	struct ds3231_prv *prv = dev_get_drvdata(dev);
+	u8 regs[DS3231_A1_LEN];
+	int ret;
+
+	if (prv->client->irq <= 0)
+		return -EINVAL;
+	regs[0] = bin2bcd(alrm->time.tm_sec);
+	regs[1] = bin2bcd(alrm->time.tm_min);
+	regs[2] = bin2bcd(alrm->time.tm_hour);		/* 24 hour mode */
+	regs[3] = bin2bcd(alrm->time.tm_mday);		/* DY/DT clear : date */
+
+	/* Disarm first so a half written match cannot fire */
+	ret = ds3231_alarm_enable(prv, DS3231_A1IE, false);
+	if (ret)
+		return ret;
+	mutex_lock(&prv->lock);
+	ret = i2c_smbus_write_i2c_block_data(prv->client, A1SEC,
+					     DS3231_A1_LEN, regs);
+	if (!ret) {
+		ret = ds3231_read_value(prv->client, STATUS);
+		if (ret >= 0)
+			ret = ds3231_write_value(prv->client, STATUS,
+						 ret & ~DS3231_A1F);
+	}
+	mutex_unlock(&prv->lock);
+	if (ret < 0)
+		return ret;
+	return alrm->enabled ? ds3231_alarm_enable(prv, DS3231_A1IE, true) : 0;
+}
+
+static int ds3231_alarm_irq_enable(struct device *dev, unsigned int enabled)
+{
+	return ds3231_alarm_enable(dev_get_drvdata(dev), DS3231_A1IE, enabled);
+}
+
+static const struct rtc_class_ops ds3231_rtc_ops = {
+	.read_time		= ds3231_read_time,
+	.set_time		= ds3231_set_time,
+	.read_alarm		= ds3231_read_alarm,
+	.set_alarm		= ds3231_set_alarm,
+	.alarm_irq_enable	= ds3231_alarm_irq_enable,
+};
+
+static ssize_t
+ds3231_date_get(struct kobject *kobj, struct kobj_attribute *attr,char *buf)
+{
+	struct ds3231_prv *prv = ds3231_from_kobj(kobj);
+	struct rtc_time tm;
+	int ret;
+
+	if (!prv)
+		return -ENODEV;
+	ret = ds3231_read_time(&prv->client->dev, &tm);
+	if (ret)
+		return ret;
+	return sprintf(buf, "Date : %04d-%02d-%02d\n", tm.tm_year + 1900,
+		       tm.tm_mon + 1, tm.tm_mday);
+}
+static ssize_t
 ds3231_time_get(struct kobject *kobj, struct kobj_attribute *attr,char *buf)
 {
-	char time[3] ={0};
-	unsigned long timeout, read_time;
-	timeout = jiffies + msecs_to_jiffies(ds3231_timeout);
-	do{
-		read_time = jiffies;
-		time[0] = ds3231_read_value(&prv->client_prv,SEC); 
-		time[1] = ds3231_read_value(&prv->client_prv,MIN);
-		time[2] = ds3231_read_value(&prv->client_prv,HOUR);
-		if (time[0] < 0 || time[1] < 0 || time[2] < 0 )
-			pr_err("Read error\n");
-		else{
-			return sprintf(buf, "Time : %d:%d:%d\n",time[0],time[1],time[2]);
-		}
-		msleep(1);
+	struct ds3231_prv *prv = ds3231_from_kobj(kobj);
+	struct rtc_time tm;
+	int ret;
+
+	if (!prv)
+		return -ENODEV;
+	ret = ds3231_read_time(&prv->client->dev, &tm);
+	if (ret)
+		return ret;
+	return sprintf(buf, "Time : %02d:%02d:%02d\n", tm.tm_hour, tm.tm_min,
+		       tm.tm_sec);
+}
+/* UTC seconds since the epoch, interpolated from the SQW cache */
+static ssize_t
+ds3231_time_ns_get(struct kobject *kobj, struct kobj_attribute *attr,char *buf)
+{
+	struct ds3231_prv *prv = ds3231_from_kobj(kobj);
+	struct timespec64 ts;
+	struct rtc_time tm;
+	int ret;
+
+	if (!prv)
+		return -ENODEV;
+	if (ds3231_cached_time(prv, &ts)) {
+		ret = ds3231_get_time(prv, &tm);
+		if (ret)
+			return ret;
+		ts.tv_sec = rtc_tm_to_time64(&tm);
+		ts.tv_nsec = 0;
+	}
+	return sprintf(buf, "%lld.%09ld\n", (long long)ts.tv_sec, ts.tv_nsec);
+}
+
+static ssize_t
+ds3231_sqw_get(struct kobject *kobj, struct kobj_attribute *attr, char *buf)
+{
+	struct ds3231_prv *prv = ds3231_from_kobj(kobj);
 
-	}while (time_before(read_time, timeout));
-	
-	return -ETIMEDOUT;
+	if (!prv)
+		return -ENODEV;
+	return sprintf(buf, "%d\n", READ_ONCE(prv->sqw));
 }
+
+static ssize_t
+ds3231_sqw_set(struct kobject *kobj, struct kobj_attribute *attr,
+	       const char *buf, size_t count)
+{
+	struct ds3231_prv *prv = ds3231_from_kobj(kobj);
+	bool on;
+	int ret;
+
+	if (!prv)
+		return -ENODEV;
+	ret = strtobool(buf, &on);
+	if (ret)
+		return ret;
+	ret = ds3231_set_sqw(prv, on);
+	return ret ? ret : count;
+}
+
+/* Alarm 2 : daily "HH:MM" match, "off" to disable; poll() wakes on a match */
+static ssize_t
+ds3231_alarm2_get(struct kobject *kobj, struct kobj_attribute *attr, char *buf)
+{
+	struct ds3231_prv *prv = ds3231_from_kobj(kobj);
+	u8 regs[DS3231_A2_LEN];
+	int control, ret;
+
+	if (!prv)
+		return -ENODEV;
+	control = ds3231_read_value(prv->client, CONTROL);
+	if (control < 0)
+		return control;
+	if (!(control & DS3231_A2IE))
+		return sprintf(buf, "off\n");
+	ret = i2c_smbus_read_i2c_block_data(prv->client, A2MIN,
+					    DS3231_A2_LEN, regs);
+	if (ret < 0)
+		return ret;
+	if (ret != DS3231_A2_LEN)
+		return -EIO;
+	return sprintf(buf, "%02d:%02d\n", bcd2bin(regs[1] & 0x3F),
+		       bcd2bin(regs[0] & 0x7F));
+}
+
+static ssize_t
+ds3231_alarm2_set(struct kobject *kobj, struct kobj_attribute *attr,
+		  const char *buf, size_t count)
+{
+	struct ds3231_prv *prv = ds3231_from_kobj(kobj);
+	u8 regs[DS3231_A2_LEN];
+	unsigned int hour, min;
+	int ret;
+
+	if (!prv)
+		return -ENODEV;
+	if (sysfs_streq(buf, "off")) {
+		ret = ds3231_alarm_enable(prv, DS3231_A2IE, false);
+		return ret ? ret : count;
+	}
+	if (sscanf(buf, "%u:%u", &hour, &min) != 2 || hour > 23 || min > 59)
+		return -EINVAL;
+	regs[0] = bin2bcd(min);
+	regs[1] = bin2bcd(hour);
+	regs[2] = DS3231_AxMx;				/* any day */
+
+	ret = ds3231_alarm_enable(prv, DS3231_A2IE, false);
+	if (ret)
+		return ret;
+	mutex_lock(&prv->lock);
+	ret = i2c_smbus_write_i2c_block_data(prv->client, A2MIN,
+					     DS3231_A2_LEN, regs);
+	if (!ret) {
+		ret = ds3231_read_value(prv->client, STATUS);
+		if (ret >= 0)
+			ret = ds3231_write_value(prv->client, STATUS,
+						 ret & ~DS3231_A2F);
+	}
+	mutex_unlock(&prv->lock);
+	if (ret < 0)
+		return ret;
+	ret = ds3231_alarm_enable(prv, DS3231_A2IE, true);
+	return ret ? ret : count;
+}
+
 static struct kobj_attribute date  = __ATTR(Date, 0444, ds3231_date_get,NULL);
 static struct kobj_attribute time  = __ATTR(Time, 0444, ds3231_time_get,NULL);
+static struct kobj_attribute time_ns = __ATTR(Time_ns, 0444, ds3231_time_ns_get, NULL);
+static struct kobj_attribute sqw   = __ATTR(Sqw_cache, 0644, ds3231_sqw_get, ds3231_sqw_set);
+static struct kobj_attribute alarm2 = __ATTR(Alarm2, 0644, ds3231_alarm2_get, ds3231_alarm2_set);
 
 static struct attribute *attrs[] = {
         &date.attr,
         &time.attr,
+        &time_ns.attr,
+        &sqw.attr,
+        &alarm2.attr,
         NULL,
 };
 
@@ -86,34 +616,152 @@ static struct attribute_group attr_group = {
         .attrs = attrs,
 };
 
-static int ds3231_probe(struct i2c_client *client, 
+static int ds3231_probe(struct i2c_client *client,
 				const struct i2c_device_id *id)
 {
+	struct ds3231_prv *prv;
+	char name[32];
 	int ret;
-	pr_info("%s: Device ds3231 probed......\n",__func__);	
-	prv=(struct ds3231_prv *)kzalloc(sizeof(struct ds3231_prv), GFP_KERNEL);		
+	pr_info("%s: Device ds3231 probed......\n",__func__);
+	if (!i2c_check_functionality(client->adapter,
+				     I2C_FUNC_SMBUS_BYTE_DATA |
+				     I2C_FUNC_SMBUS_I2C_BLOCK))
+		return -EOPNOTSUPP;
+	prv=(struct ds3231_prv *)kzalloc(sizeof(struct ds3231_prv), GFP_KERNEL);
 	if(!prv){
 		pr_info("Requested memory not allocated\n");
 		return -ENOMEM;
 	}
-	prv->client_prv = *client;
-	prv->ds3231_kobj=kobject_create_and_add("ds3231", NULL);
-	if(!prv->ds3231_kobj)
-		return -ENOMEM;
+	prv->client = client;
+	mutex_init(&prv->lock);
+	seqlock_init(&prv->cache_lock);
+	i2c_set_clientdata(client, prv);
+
+	/* Is it there at all : hwclock would only see errors later */
+	ret = ds3231_read_value(client, STATUS);
+	if (ret < 0) {
+		dev_err(&client->dev, "no response %d\n", ret);
+		goto err_free;
+	}
+	if (ret & DS3231_OSF)
+		dev_warn(&client->dev, "oscillator stopped, set the time\n");
+	/* A flag left from before would hold INT low : no edge, no alarms */
+	if (ret & (DS3231_A1F | DS3231_A2F)) {
+		ret = ds3231_write_value(client, STATUS,
+					 ret & ~(DS3231_A1F | DS3231_A2F));
+		if (ret < 0)
+			goto err_free;
+	}
+	/*
+	 * CONTROL is battery backed : a square wave left on by a previous
+	 * Sqw_cache user would hit the alarm handler every second. Start in
+	 * interrupt mode, Sqw_cache off.
+	 */
+	if (client->irq > 0) {
+		ret = ds3231_read_value(client, CONTROL);
+		if (ret >= 0 && !(ret & DS3231_INTCN))
+			ret = ds3231_write_value(client, CONTROL,
+					(ret & ~DS3231_RS_MASK) | DS3231_INTCN);
+		if (ret < 0)
+			goto err_free;
+		device_init_wakeup(&client->dev, true);
+	}
+
+	prv->rtc = rtc_device_register(client->name, &client->dev,
+				       &ds3231_rtc_ops, THIS_MODULE);
+	if (IS_ERR(prv->rtc)) {
+		ret = PTR_ERR(prv->rtc);
+		dev_err(&client->dev, "rtc register failed %d\n", ret);
+		goto err_free;
+	}
+
+	/* Before the IRQ : the Alarm2 notify needs it, and it goes last */
+	snprintf(name, sizeof(name), "ds3231-%d-%02x",
+		 client->adapter->nr, client->addr);
+	prv->ds3231_kobj=kobject_create_and_add(name, NULL);
+	if(!prv->ds3231_kobj){
+		ret = -ENOMEM;
+		goto err_rtc;
+	}
 	ret= sysfs_create_group(prv->ds3231_kobj, &attr_group);
 	if(ret)
-		kobject_put(prv->ds3231_kobj);
-	
+		goto err_kobj;
+
+	/* INT/SQW, trigger type from the node (falling edge) */
+	if (client->irq > 0) {
+		ret = request_threaded_irq(client->irq, ds3231_irq,
+					   ds3231_irq_thread, IRQF_ONESHOT,
+					   "ds3231", prv);
+		if (ret) {
+			dev_err(&client->dev, "irq %d failed %d\n",
+				client->irq, ret);
+			goto err_kobj;
+		}
+	}
+
+	mutex_lock(&ds3231_chips_lock);
+	list_add_tail(&prv->node, &ds3231_chips);
+	mutex_unlock(&ds3231_chips_lock);
 	return 0;
+err_kobj:
+	kobject_put(prv->ds3231_kobj);
+err_rtc:
+	rtc_device_unregister(prv->rtc);
+err_free:
+	device_init_wakeup(&client->dev, false);
+	kfree(prv);
+	return ret;
 }
 static int ds3231_remove(struct i2c_client *client)
 {
+	struct ds3231_prv *prv = i2c_get_clientdata(client);
+
 	pr_info("ds3231_remove\n");
-	kfree(prv);
+	mutex_lock(&ds3231_chips_lock);
+	list_del(&prv->node);
+	mutex_unlock(&ds3231_chips_lock);
+	/* Quiet INT/SQW and the handler before the kobject it notifies goes */
+	if (prv->sqw)
+		ds3231_set_sqw(prv, false);
+	if (client->irq > 0) {
+		ds3231_alarm_enable(prv, DS3231_A1IE | DS3231_A2IE, false);
+		free_irq(client->irq, prv);
+	}
 	kobject_put(prv->ds3231_kobj);
+	prv->ds3231_kobj = NULL;
+	rtc_device_unregister(prv->rtc);
+	device_init_wakeup(&client->dev, false);
+	kfree(prv);
 	return 0;
 }
 
+#ifdef CONFIG_PM_SLEEP
+/* An armed alarm brings the system back out of suspend */
+static int ds3231_suspend(struct device *dev)
+{
+	struct i2c_client *client = to_i2c_client(dev);
+	struct ds3231_prv *prv = i2c_get_clientdata(client);
+
+	if (client->irq > 0 && device_may_wakeup(dev))
+		prv->irq_wake = !enable_irq_wake(client->irq);
+	return 0;
+}
+
+static int ds3231_resume(struct device *dev)
+{
+	struct i2c_client *client = to_i2c_client(dev);
+	struct ds3231_prv *prv = i2c_get_clientdata(client);
+
+	if (prv->irq_wake) {
+		disable_irq_wake(client->irq);
+		prv->irq_wake = false;
+	}
+	return 0;
+}
+#endif
+
+static SIMPLE_DEV_PM_OPS(ds3231_pm_ops, ds3231_suspend, ds3231_resume);
+
 static const struct i2c_device_id ds3231_ids[]={
 	{ "ds3231", 0x68 },
 	{ }
@@ -123,6 +771,7 @@ static struct i2c_driver ds3231_drv = {
 	.driver = {
 		.name = "ds3231",
 		.owner = THIS_MODULE,
+		.pm = &ds3231_pm_ops,
 	},
 	.probe    = ds3231_probe,
 	.remove   = ds3231_remove,
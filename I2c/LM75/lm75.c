@@ -8,23 +8,87 @@
 #include <linux/i2c.h>
 #include <linux/jiffies.h>
 #include <linux/delay.h>
+#include <linux/mutex.h>
+#include <linux/err.h>
+#include <linux/hwmon.h>
+#include <linux/hwmon-sysfs.h>
+#include <linux/interrupt.h>
+#include <linux/list.h>
+#include <linux/kthread.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
 
 struct lm75_prv {
-	struct i2c_client client_prv;
+	struct i2c_client *client;
 	struct kobject *lm75_kobj;
+	struct device *hwmon_dev;
         char *ptr;
 	u8 orig_conf;
+
+	/* TEMP register cache, refreshed at most once per update_interval */
+	struct mutex update_lock;
+	bool valid;
+	unsigned long last_updated;	/* jiffies */
+	unsigned int update_interval;	/* ms */
+	s16 temp;			/* raw register */
+	s16 tos, thyst;			/* raw registers, written only here */
+	bool alarm;			/* above Tos, until below Thyst */
+
+	struct list_head node;		/* on lm75_chips */
+};
+
+static LIST_HEAD(lm75_chips);		/* ordered by adapter, then address */
+static DEFINE_MUTEX(lm75_chips_lock);
+
+/*
+ * Optional aggregator : /sys/lm75_array, present while at least one chip
+ * is bound. Writing interval_ms starts one kthread that reads every chip
+ * back to back on a fixed schedule and publishes the temperatures with
+ * a single timestamp in temps.
+ */
+#define LM75_ARRAY_MAX		16
+
+static bool aggregate = true;
+module_param(aggregate, bool, 0444);
+MODULE_PARM_DESC(aggregate, "Publish all bound chips in /sys/lm75_array");
+
+static DEFINE_MUTEX(lm75_array_lock);	/* serialises (re)creating the kobject */
+static struct kobject *lm75_array_kobj;
+static DEFINE_MUTEX(lm75_scan_task_lock);	/* the kthread and interval */
+static struct task_struct *lm75_scan_task;
+static unsigned int lm75_scan_ms;
+static bool lm75_array_live;
+
+struct lm75_scan_entry {
+	int bus;
+	u16 addr;
+	int status;			/* < 0 : read error */
+	int mc;
 };
 
-struct lm75_prv *prv=NULL;
+static DEFINE_MUTEX(lm75_scan_lock);	/* the published scan */
+static struct {
+	ktime_t timestamp;
+	unsigned int n;
+	struct lm75_scan_entry s[LM75_ARRAY_MAX];
+} lm75_scan;
 
 /* The LM75 registers */
 enum lm75_Reg {
 	LM75_REG_CONF	= 0x01,
 	LM75_REG_TEMP	= 0x00,
+	LM75_REG_THYST	= 0x02,
+	LM75_REG_TOS	= 0x03,
 };
 
-static unsigned lm75_timeout = 25; /*default timeout for normal I2c  devices */
+/* CONF bits */
+#define LM75_OS_COMP_INT	(1 << 1)	/* 0 : comparator mode */
+#define LM75_OS_POL		(1 << 2)	/* 0 : OS active low */
+
+/* LM75B converts every 100 ms, reading faster only returns the same value */
+#define LM75_INTERVAL_MIN	100
+#define LM75_INTERVAL_MAX	60000
+#define LM75_INTERVAL_DEF	500	/* ms */
 /* register access */
 
 /* All registers are word-sized, except for the configuration register.
@@ -58,75 +122,88 @@ static inline int LM75_TEMP_FROM_REG(u16 reg)
 	return ((s16)reg / 128) * 5/10;
 }
 
-#if 0
-static size_t lm75_temp_read(struct i2c_client *client, char *buf)
+/* hwmon : 0.001C/bit. LM75B has 11 bits (0.125C), D4..D0 read as zero */
+static inline int LM75_TEMP_MC_FROM_REG(u16 reg)
 {
-	struct i2c_msg msg[2]; /*array of msg buf*/
-	u8 msgbuf[1];
-	unsigned long timeout, read_time;
-	int status;
-	memset(msg, 0, sizeof(msg));
-	
-	msgbuf[0] = LM75_REG_TEMP;
-	/*writing part i.e perform writing 1 byte and device addr*/
-	//msg[0].addr = client->addr;
-	msg[0].addr = 0x48;
+	return ((s16)reg >> 5) * 125;
+}
 
-	msg[0].flags = 0;
-	msg[0].buf = msgbuf;
+/* Tos/Thyst : 9 bits, 0.5C/bit, -55C to +125C */
+static inline u16 LM75_TEMP_TO_REG(long mc)
+{
+	mc = clamp_val(mc, -55000, 125000);
+	return (u16)(DIV_ROUND_CLOSEST(mc, 500) << 7);
+}
 
-	msg[0].len = 2;
-	
-	//msg[1].addr = client->addr;
-	msg[1].addr = 0x48;
-	msg[1].flags = 1; /* Read */
-	msg[1].buf = buf; 
-	msg[1].len = 2;
-	
-	timeout = jiffies + msecs_to_jiffies(lm75_timeout);
-	do {
-		read_time = jiffies;
-
-		status = i2c_transfer(client->adapter, msg, 2);
-		if (status == 2)
-			status = 16;
-		if (status == 16) {
-			return 0;
+/* The OS output's comparator behaviour, on the last reading. update_lock held */
+static void lm75_eval_alarm(struct lm75_prv *prv)
+{
+	if (prv->temp >= prv->tos)
+		prv->alarm = true;
+	else if (prv->temp < prv->thyst)
+		prv->alarm = false;
+}
+
+/* A fresh TEMP register value. update_lock held */
+static void lm75_store_temp(struct lm75_prv *prv, int reg)
+{
+	prv->temp = reg;
+	prv->last_updated = jiffies;
+	prv->valid = true;
+	lm75_eval_alarm(prv);
+}
+
+static struct lm75_prv *lm75_from_kobj(struct kobject *kobj)
+{
+	struct lm75_prv *prv, *found = NULL;
+
+	mutex_lock(&lm75_chips_lock);
+	list_for_each_entry(prv, &lm75_chips, node) {
+		if (prv->lm75_kobj == kobj) {
+			found = prv;
+			break;
 		}
-		msleep(1);
-	} while (time_before(read_time, timeout));
+	}
+	mutex_unlock(&lm75_chips_lock);
+	return found;
+}
 
-	return -ETIMEDOUT;
+/* One bus transaction per update_interval, however many readers */
+static int lm75_update(struct lm75_prv *prv, s16 *temp)
+{
+	int status = 0;
 
+	mutex_lock(&prv->update_lock);
+	if (!prv->valid || time_after(jiffies, prv->last_updated +
+				      msecs_to_jiffies(prv->update_interval))) {
+		status = lm75_read_value(prv->client, LM75_REG_TEMP);
+		if (status < 0) {
+			dev_err(&prv->client->dev, "reg %d, err %d\n",
+				LM75_REG_TEMP, status);
+			prv->valid = false;
+		} else {
+			lm75_store_temp(prv, status);
+			status = 0;
+		}
+	}
+	*temp = prv->temp;
+	mutex_unlock(&prv->update_lock);
+	return status;
 }
-#endif
-static size_t 
+
+static ssize_t 
 lm75_get_temp(struct kobject *kobj, struct kobj_attribute *attr, char *buf)
 {
-	size_t status;
-	unsigned long timeout, read_time;
-#if 0
-	ret = lm75_temp_read(&prv->client_prv, buf);
-	if (ret < 0) {
-		pr_info("error in reading\n");
+	struct lm75_prv *prv = lm75_from_kobj(kobj);
+	s16 temp;
+	int ret;
+
+	if (!prv)
+		return -ENODEV;
+	ret = lm75_update(prv, &temp);
+	if (ret < 0)
 		return ret;
-	}
-#endif
-	timeout = jiffies + msecs_to_jiffies(lm75_timeout);
-	do{
-		read_time = jiffies;
-		status = lm75_read_value(&prv->client_prv, LM75_REG_TEMP);
-		if (status < 0)
-			pr_err("reg %d, err %d\n",
-						LM75_REG_TEMP, status);
-		else{
-			return sprintf(buf, "%d\n",
-					LM75_TEMP_FROM_REG(status));
-		}
-		msleep(1);
-	}while (time_before(read_time, timeout));
-	return -ETIMEDOUT;
-	
+	return sprintf(buf, "%d\n", LM75_TEMP_FROM_REG(temp));
 }
 static struct kobj_attribute lm75_temp = __ATTR(temp,0444,lm75_get_temp,NULL);
 
@@ -139,23 +216,362 @@ static struct attribute_group attr_group = {
         .attrs = attrs,
 };
 
+/* hwmon interface : temp1_input and update_interval */
+static ssize_t lm75_show_temp(struct device *dev, struct device_attribute *da,
+			      char *buf)
+{
+	struct lm75_prv *data = dev_get_drvdata(dev);
+	s16 temp;
+	int ret;
+
+	ret = lm75_update(data, &temp);
+	if (ret < 0)
+		return ret;
+	return sprintf(buf, "%d\n", LM75_TEMP_MC_FROM_REG(temp));
+}
+
+static ssize_t lm75_show_interval(struct device *dev,
+				  struct device_attribute *da, char *buf)
+{
+	struct lm75_prv *data = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", data->update_interval);
+}
+
+static ssize_t lm75_set_interval(struct device *dev,
+				 struct device_attribute *da,
+				 const char *buf, size_t count)
+{
+	struct lm75_prv *data = dev_get_drvdata(dev);
+	unsigned long val;
+	int ret;
+
+	ret = kstrtoul(buf, 10, &val);
+	if (ret)
+		return ret;
+	mutex_lock(&data->update_lock);
+	data->update_interval = clamp_val(val, LM75_INTERVAL_MIN,
+					  LM75_INTERVAL_MAX);
+	mutex_unlock(&data->update_lock);
+	return count;
+}
+
+/* temp1_max = Tos, temp1_max_hyst = Thyst; index is the register */
+static ssize_t lm75_show_limit(struct device *dev, struct device_attribute *da,
+			       char *buf)
+{
+	struct sensor_device_attribute *attr = to_sensor_dev_attr(da);
+	struct lm75_prv *data = dev_get_drvdata(dev);
+	s16 val;
+
+	mutex_lock(&data->update_lock);
+	val = attr->index == LM75_REG_TOS ? data->tos : data->thyst;
+	mutex_unlock(&data->update_lock);
+	return sprintf(buf, "%d\n", LM75_TEMP_MC_FROM_REG(val));
+}
+
+static ssize_t lm75_set_limit(struct device *dev, struct device_attribute *da,
+			      const char *buf, size_t count)
+{
+	struct sensor_device_attribute *attr = to_sensor_dev_attr(da);
+	struct lm75_prv *data = dev_get_drvdata(dev);
+	long val;
+	u16 reg;
+	int ret;
+
+	ret = kstrtol(buf, 10, &val);
+	if (ret)
+		return ret;
+	reg = LM75_TEMP_TO_REG(val);
+	mutex_lock(&data->update_lock);
+	ret = lm75_write_value(data->client, attr->index, reg);
+	if (!ret) {
+		if (attr->index == LM75_REG_TOS)
+			data->tos = reg;
+		else
+			data->thyst = reg;
+	}
+	mutex_unlock(&data->update_lock);
+	return ret ? ret : count;
+}
+
+static ssize_t lm75_show_alarm(struct device *dev, struct device_attribute *da,
+			       char *buf)
+{
+	struct lm75_prv *data = dev_get_drvdata(dev);
+	s16 temp;
+	int ret;
+
+	/* With the OS interrupt the alarm follows its edges, else the cache */
+	if (data->client->irq <= 0) {
+		ret = lm75_update(data, &temp);
+		if (ret < 0)
+			return ret;
+	}
+	return sprintf(buf, "%d\n", READ_ONCE(data->alarm));
+}
+
+static SENSOR_DEVICE_ATTR(temp1_input, S_IRUGO, lm75_show_temp, NULL, 0);
+static SENSOR_DEVICE_ATTR(temp1_max, S_IRUGO | S_IWUSR, lm75_show_limit,
+			  lm75_set_limit, LM75_REG_TOS);
+static SENSOR_DEVICE_ATTR(temp1_max_hyst, S_IRUGO | S_IWUSR, lm75_show_limit,
+			  lm75_set_limit, LM75_REG_THYST);
+static SENSOR_DEVICE_ATTR(temp1_max_alarm, S_IRUGO, lm75_show_alarm, NULL, 0);
+static DEVICE_ATTR(update_interval, S_IRUGO | S_IWUSR, lm75_show_interval,
+		   lm75_set_interval);
+
+static struct attribute *lm75_attrs[] = {
+	&sensor_dev_attr_temp1_input.dev_attr.attr,
+	&sensor_dev_attr_temp1_max.dev_attr.attr,
+	&sensor_dev_attr_temp1_max_hyst.dev_attr.attr,
+	&sensor_dev_attr_temp1_max_alarm.dev_attr.attr,
+	&dev_attr_update_interval.attr,
+	NULL,
+};
+ATTRIBUTE_GROUPS(lm75);
+
+/*
+ * OS pin, comparator mode : it asserts when TEMP reaches Tos and releases
+ * below Thyst, the node maps both edges. Each edge costs one TEMP read,
+ * which also refreshes the cache, then pollers of temp1_max_alarm and
+ * /sys/lm75/temp are woken and a change uevent goes out.
+ */
+static irqreturn_t lm75_os_irq(int irq, void *dev_id)
+{
+	struct lm75_prv *prv = dev_id;
+	int status;
+
+	mutex_lock(&prv->update_lock);
+	status = lm75_read_value(prv->client, LM75_REG_TEMP);
+	if (status >= 0)
+		lm75_store_temp(prv, status);
+	mutex_unlock(&prv->update_lock);
+	if (status < 0) {
+		dev_err(&prv->client->dev, "OS edge, TEMP read err %d\n", status);
+		return IRQ_HANDLED;
+	}
+
+	sysfs_notify(&prv->hwmon_dev->kobj, NULL, "temp1_max_alarm");
+	sysfs_notify(prv->lm75_kobj, NULL, "temp");
+	kobject_uevent(&prv->hwmon_dev->kobj, KOBJ_CHANGE);
+	return IRQ_HANDLED;
+}
+
+/* Read every bound chip back to back, then publish them as one scan */
+static void lm75_scan_once(void)
+{
+	struct lm75_scan_entry s[LM75_ARRAY_MAX];
+	struct lm75_prv *prv;
+	unsigned int n = 0;
+	ktime_t ts;
+	int status;
+
+	mutex_lock(&lm75_chips_lock);
+	ts = ktime_get();
+	list_for_each_entry(prv, &lm75_chips, node) {
+		if (n == LM75_ARRAY_MAX)
+			break;
+		mutex_lock(&prv->update_lock);
+		status = lm75_read_value(prv->client, LM75_REG_TEMP);
+		if (status >= 0)
+			lm75_store_temp(prv, status);	/* hwmon readers reuse it */
+		mutex_unlock(&prv->update_lock);
+
+		s[n].bus = prv->client->adapter->nr;
+		s[n].addr = prv->client->addr;
+		s[n].status = status < 0 ? status : 0;
+		s[n].mc = status < 0 ? 0 : LM75_TEMP_MC_FROM_REG(status);
+		n++;
+	}
+	mutex_unlock(&lm75_chips_lock);
+
+	mutex_lock(&lm75_scan_lock);
+	lm75_scan.timestamp = ts;
+	lm75_scan.n = n;
+	memcpy(lm75_scan.s, s, n * sizeof(s[0]));
+	mutex_unlock(&lm75_scan_lock);
+	sysfs_notify(lm75_array_kobj, NULL, "temps");
+}
+
+static int lm75_scan_thread(void *arg)
+{
+	ktime_t next = ktime_get();
+
+	while (!kthread_should_stop()) {
+		lm75_scan_once();
+		/* Fixed schedule, a late scan does not shift the next ones */
+		next = ktime_add_ms(next, READ_ONCE(lm75_scan_ms));
+		if (ktime_before(next, ktime_get()))
+			next = ktime_get();
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (!kthread_should_stop())
+			schedule_hrtimeout(&next, HRTIMER_MODE_ABS);
+		__set_current_state(TASK_RUNNING);
+	}
+	return 0;
+}
+
+/* Start, retune or stop the scan thread. lm75_scan_task_lock held */
+static int lm75_scan_set(unsigned int ms)
+{
+	struct task_struct *task;
+
+	if (ms && !lm75_array_live)
+		return -ENODEV;
+	WRITE_ONCE(lm75_scan_ms, ms);
+	if (!ms && lm75_scan_task) {
+		kthread_stop(lm75_scan_task);
+		lm75_scan_task = NULL;
+	} else if (ms && !lm75_scan_task) {
+		task = kthread_run(lm75_scan_thread, NULL, "lm75_scan");
+		if (IS_ERR(task))
+			return PTR_ERR(task);
+		lm75_scan_task = task;
+	} else if (ms) {
+		/* Pick up the new interval now rather than after the old one */
+		wake_up_process(lm75_scan_task);
+	}
+	return 0;
+}
+
+static ssize_t lm75_array_interval_show(struct kobject *kobj,
+					struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", READ_ONCE(lm75_scan_ms));
+}
+
+static ssize_t lm75_array_interval_store(struct kobject *kobj,
+					 struct kobj_attribute *attr,
+					 const char *buf, size_t count)
+{
+	unsigned int ms;
+	int ret;
+
+	ret = kstrtouint(buf, 10, &ms);
+	if (ret)
+		return ret;
+	/* 0 stops; LM75B converts every 100 ms */
+	if (ms && (ms < LM75_INTERVAL_MIN || ms > LM75_INTERVAL_MAX))
+		return -EINVAL;
+	mutex_lock(&lm75_scan_task_lock);
+	ret = lm75_scan_set(ms);
+	mutex_unlock(&lm75_scan_task_lock);
+	return ret ? ret : count;
+}
+
+/* Line 1 : timestamp, ns CLOCK_MONOTONIC. Then "<bus>-<addr> <mC>" per chip */
+static ssize_t lm75_array_temps_show(struct kobject *kobj,
+				     struct kobj_attribute *attr, char *buf)
+{
+	ssize_t len;
+	unsigned int i;
+
+	mutex_lock(&lm75_scan_lock);
+	len = sprintf(buf, "%lld\n", ktime_to_ns(lm75_scan.timestamp));
+	for (i = 0; i < lm75_scan.n; i++) {
+		len += sprintf(buf + len, "%d-%02x ", lm75_scan.s[i].bus,
+			       lm75_scan.s[i].addr);
+		if (lm75_scan.s[i].status)
+			len += sprintf(buf + len, "%d\n", lm75_scan.s[i].status);
+		else
+			len += sprintf(buf + len, "%d\n", lm75_scan.s[i].mc);
+	}
+	mutex_unlock(&lm75_scan_lock);
+	return len;
+}
+
+static struct kobj_attribute lm75_array_interval =
+	__ATTR(interval_ms, 0644, lm75_array_interval_show,
+	       lm75_array_interval_store);
+static struct kobj_attribute lm75_array_temps =
+	__ATTR(temps, 0444, lm75_array_temps_show, NULL);
+
+static struct attribute *lm75_array_attrs[] = {
+	&lm75_array_interval.attr,
+	&lm75_array_temps.attr,
+	NULL,
+};
+
+static struct attribute_group lm75_array_group = {
+	.attrs = lm75_array_attrs,
+};
+
+/*
+ * Create /sys/lm75_array with the first chip, tear it down with the last.
+ * Must not be called with lm75_chips_lock held : the scan thread takes it
+ * and removing the kobject waits for its attribute callbacks.
+ */
+static void lm75_array_update(void)
+{
+	bool empty;
+
+	if (!aggregate)
+		return;
+	mutex_lock(&lm75_array_lock);
+	mutex_lock(&lm75_chips_lock);
+	empty = list_empty(&lm75_chips);
+	mutex_unlock(&lm75_chips_lock);
+	if (empty && lm75_array_kobj) {
+		mutex_lock(&lm75_scan_task_lock);
+		lm75_array_live = false;
+		lm75_scan_set(0);
+		mutex_unlock(&lm75_scan_task_lock);
+		kobject_put(lm75_array_kobj);
+		lm75_array_kobj = NULL;
+	} else if (!empty && !lm75_array_kobj) {
+		lm75_array_kobj = kobject_create_and_add("lm75_array", NULL);
+		if (lm75_array_kobj &&
+		    sysfs_create_group(lm75_array_kobj, &lm75_array_group)) {
+			kobject_put(lm75_array_kobj);
+			lm75_array_kobj = NULL;
+		}
+		if (lm75_array_kobj) {
+			mutex_lock(&lm75_scan_task_lock);
+			lm75_array_live = true;
+			mutex_unlock(&lm75_scan_task_lock);
+		}
+	}
+	mutex_unlock(&lm75_array_lock);
+}
+
+/* Keep the list ordered by adapter then address, as the scan reports it */
+static void lm75_chips_insert(struct lm75_prv *new)
+{
+	struct lm75_prv *prv;
+
+	list_for_each_entry(prv, &lm75_chips, node) {
+		if (prv->client->adapter->nr > new->client->adapter->nr ||
+		    (prv->client->adapter->nr == new->client->adapter->nr &&
+		     prv->client->addr > new->client->addr))
+			break;
+	}
+	list_add_tail(&new->node, &prv->node);
+}
+
 static int 
 lm75_probe(struct i2c_client *client, const struct i2c_device_id *id)
 {
+	struct lm75_prv *prv;
+	char name[32];
 	int ret, new;
 	int status;
 	u8 set_mask, clr_mask;
+	s16 temp;
 	pr_info("%s: Device lm75 probed.!!\n",__func__);	
 	prv=(struct lm75_prv *)kzalloc(sizeof(struct lm75_prv), GFP_KERNEL);		
 	if(!prv){
 		pr_info("Requested memory not allocated\n");
 		return -ENOMEM;
 	}
-	prv->client_prv = *client;
+	prv->client = client;
+	mutex_init(&prv->update_lock);
+	prv->update_interval = LM75_INTERVAL_DEF;
 	
 	set_mask = 0;
 	clr_mask = (1 << 0)			/* continuous conversions */
 		| (1 << 6) | (1 << 5); 		/* 9-bit mode */
+	if (client->irq > 0)
+		clr_mask |= LM75_OS_COMP_INT | LM75_OS_POL;	/* comparator, active low */
 	/* configure as specified */
 	status = lm75_read_value(client, LM75_REG_CONF);
 	if (status < 0) 
@@ -167,22 +583,78 @@ lm75_probe(struct i2c_client *client, const struct i2c_device_id *id)
 	if (status != new)
 		lm75_write_value(client, LM75_REG_CONF, new);
 	dev_dbg(&client->dev, "Config %02x\n", new);
+
+	status = lm75_read_value(client, LM75_REG_TOS);
+	ret = lm75_read_value(client, LM75_REG_THYST);
+	if (status < 0 || ret < 0) {
+		ret = status < 0 ? status : ret;
+		dev_err(&client->dev, "Can't read Tos/Thyst %d\n", ret);
+		goto err_free;
+	}
+	prv->tos = status;
+	prv->thyst = ret;
+	/* Initial alarm state : the OS line may already be asserted */
+	lm75_update(prv, &temp);
 	
 
-	prv->lm75_kobj=kobject_create_and_add("lm75", NULL);
-	if(!prv->lm75_kobj)
-		return -ENOMEM;
+	prv->hwmon_dev = hwmon_device_register_with_groups(&client->dev,
+							   client->name, prv,
+							   lm75_groups);
+	if (IS_ERR(prv->hwmon_dev)) {
+		ret = PTR_ERR(prv->hwmon_dev);
+		goto err_free;
+	}
+
+	/* One directory per chip : /sys/lm75-<bus>-<addr> */
+	snprintf(name, sizeof(name), "lm75-%d-%02x",
+		 client->adapter->nr, client->addr);
+	prv->lm75_kobj=kobject_create_and_add(name, NULL);
+	if(!prv->lm75_kobj){
+		ret = -ENOMEM;
+		goto err_hwmon;
+	}
 	ret= sysfs_create_group(prv->lm75_kobj, &attr_group);
 	if(ret)
-		kobject_put(prv->lm75_kobj);
+		goto err_kobj;
+	if (client->irq > 0) {
+		ret = request_threaded_irq(client->irq, NULL, lm75_os_irq,
+					   IRQF_ONESHOT, "lm75", prv);
+		if (ret) {
+			dev_err(&client->dev, "OS irq %d failed %d\n",
+				client->irq, ret);
+			goto err_kobj;
+		}
+	}
+	i2c_set_clientdata(client, prv);
+
+	mutex_lock(&lm75_chips_lock);
+	lm75_chips_insert(prv);
+	mutex_unlock(&lm75_chips_lock);
+	lm75_array_update();
 	return 0;
+err_kobj:
+	kobject_put(prv->lm75_kobj);
+err_hwmon:
+	hwmon_device_unregister(prv->hwmon_dev);
+err_free:
+	kfree(prv);
+	return ret;
 }
 
 static int lm75_remove(struct i2c_client *client)
 {
+	struct lm75_prv *prv = i2c_get_clientdata(client);
+
 	pr_info("lm75_remove\n");
-	kfree(prv); 
+	mutex_lock(&lm75_chips_lock);
+	list_del(&prv->node);
+	mutex_unlock(&lm75_chips_lock);
+	lm75_array_update();
+	if (client->irq > 0)
+		free_irq(client->irq, prv);
 	kobject_put(prv->lm75_kobj);
+	hwmon_device_unregister(prv->hwmon_dev);
+	kfree(prv); 
 	return 0;
 }
 static const struct i2c_device_id lm75_ids[]={
@@ -6,24 +6,56 @@
 #include <linux/kernel.h>
 #include <linux/delay.h>
 #include <linux/jiffies.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/sysfs.h>
+#include <linux/property.h>
+#include <linux/hashtable.h>
+#include <linux/jhash.h>
+#include <linux/crc16.h>
 
 struct i2c_eeprom_prv {
-	struct i2c_client client_prv;
+	struct i2c_client *client;
 	struct kobject *at24_kobj;
+	struct list_head node;		/* entry in at24_chips, sorted by address */
+	struct mutex lock;
         char *ptr;
         unsigned int size;
         unsigned int pagesize;
         unsigned int address_width;
         unsigned int page_no;
+	/* key/value journal, see at24_journal_append() */
+	unsigned int jpages;		/* pages per bank, 0 = no journal */
+	unsigned int jbase;		/* first page of bank 0 */
+	unsigned int jbank;		/* active bank */
+	unsigned int jhead;		/* next free slot in the active bank */
+	unsigned int jlive;		/* keys in the index */
+	unsigned int jcompactions;
+	u32 jseq;			/* sequence number of the next record */
+	DECLARE_HASHTABLE(kv_index, 5);
+	char kv_key[32];		/* key selected through kv/key */
 };
 
-struct i2c_eeprom_prv *prv=NULL;
+/*
+ * Every bound chip is kept on at24_chips in (adapter, address) order. When
+ * more than one chip is present the aggregation layer exposes them as one
+ * linear space in /sys/at24c32_array/eeprom : chip 0x50 first, then 0x51 ...
+ */
+static LIST_HEAD(at24_chips);
+static DEFINE_MUTEX(at24_chips_lock);
+static DEFINE_MUTEX(at24_array_lock);	/* serialises (re)creating the bin file */
+static struct kobject *at24_array_kobj;
+static bool at24_array_bin_added;
+
+static bool aggregate = true;
+module_param(aggregate, bool, 0444);
+MODULE_PARM_DESC(aggregate, "Concatenate all bound chips into /sys/at24c32_array/eeprom");
 
 static unsigned read_limit    = 32; /* Page size is 32 so read and write limit should not more then 32 bytes : page 3 of AT24C32 data sheet*/
 static unsigned write_max     = 32;
 static unsigned write_timeout = 25; /*default timeout for normal I2c  devices */
 
-static size_t at24_eeprom_read(struct i2c_client *client, char *buf,
+static ssize_t at24_eeprom_read(struct i2c_client *client, char *buf,
 				unsigned offset, size_t count)
 {
 	struct i2c_msg msg[2]; /*array of msg buf*/
@@ -38,16 +70,14 @@ static size_t at24_eeprom_read(struct i2c_client *client, char *buf,
 	msgbuf[0] = offset >> 8;
 	msgbuf[1] = offset;
 	/*writing part i.e perform writing 1 byte and device addr*/
-	//msg[0].addr = client->addr;
-	msg[0].addr = 0x57;
+	msg[0].addr = client->addr;
 
 	msg[0].flags = 0;
 	msg[0].buf = msgbuf;
 
 	msg[0].len = 2;
 	
-	//msg[1].addr = client->addr;
-	msg[1].addr = 0x57;
+	msg[1].addr = client->addr;
 	msg[1].flags = 1; /* Read */
 	msg[1].buf = buf; 
 	msg[1].len = count;
@@ -81,8 +111,7 @@ static ssize_t at24_eeprom_write(struct i2c_client *client, const char *buf,
 	if (count >= write_max)
 		count = write_max; /*Count should not exceed from write_max*/
 	/* chip address - NOTE: 7bit addresses are stored in the _LOWER_ 7 bits		*/
-//	msg.addr = client->addr;
-	msg.addr = 0x57;
+	msg.addr = client->addr;
 	
 	/**/
 	msg.flags = 0; /*0= write , 1 = read */
@@ -113,18 +142,52 @@ static ssize_t at24_eeprom_write(struct i2c_client *client, const char *buf,
 	return -ETIMEDOUT;
 }
 
+/* Raw access must not scribble over the journal behind the index's back */
+static bool at24_in_journal(struct i2c_eeprom_prv *prv, unsigned int off,
+			    size_t count)
+{
+	unsigned int start = prv->jbase * prv->pagesize;
+
+	return prv->jpages && off + count > start;
+}
+
+/* Find the chip owning a per-device kobject (attributes are shared by all chips) */
+static struct i2c_eeprom_prv *at24_from_kobj(struct kobject *kobj)
+{
+	struct i2c_eeprom_prv *prv, *found = NULL;
+
+	mutex_lock(&at24_chips_lock);
+	list_for_each_entry(prv, &at24_chips, node) {
+		if (prv->at24_kobj == kobj) {
+			found = prv;
+			break;
+		}
+	}
+	mutex_unlock(&at24_chips_lock);
+	return found;
+}
+
 static ssize_t at24_sys_write(struct kobject *kobj, struct kobj_attribute *attr,
 		 const char *buf, size_t count)
 {
-	size_t ret;
-
-	loff_t off = prv->page_no * 32;
+	struct i2c_eeprom_prv *prv = at24_from_kobj(kobj);
+	ssize_t ret;
+	loff_t off;
 
+	if (!prv)
+		return -ENODEV;
 	if (count > write_max) {
 		pr_info("write length must be <= 32\n");
 		return -EFBIG;
 	}
-	ret = at24_eeprom_write(&prv->client_prv, buf, (int)off, count);
+	mutex_lock(&prv->lock);
+	off = prv->page_no * prv->pagesize;
+	if (at24_in_journal(prv, off, count)) {
+		mutex_unlock(&prv->lock);
+		return -EBUSY;
+	}
+	ret = at24_eeprom_write(prv->client, buf, (int)off, count);
+	mutex_unlock(&prv->lock);
 	if (ret < 0) {
 		pr_info("write failed\n");
 		return ret;
@@ -136,10 +199,16 @@ static ssize_t at24_sys_write(struct kobject *kobj, struct kobj_attribute *attr,
 static ssize_t at24_sys_read(struct kobject *kobj, struct kobj_attribute *attr, 
 		char *buf)
 {
-	size_t ret;
+	struct i2c_eeprom_prv *prv = at24_from_kobj(kobj);
+	ssize_t ret;
+	loff_t off;
 
-	loff_t off = prv->page_no * 32;
-	ret = at24_eeprom_read(&prv->client_prv, buf, (int)off, prv->pagesize);
+	if (!prv)
+		return -ENODEV;
+	mutex_lock(&prv->lock);
+	off = prv->page_no * prv->pagesize;
+	ret = at24_eeprom_read(prv->client, buf, (int)off, prv->pagesize);
+	mutex_unlock(&prv->lock);
 	if (ret < 0) {
 		pr_info("error in reading\n");
 		return ret;
@@ -150,9 +219,11 @@ static ssize_t at24_sys_read(struct kobject *kobj, struct kobj_attribute *attr,
 static ssize_t at24_get_offset(struct kobject *kobj, struct kobj_attribute *attr, 
 		char *buf)
 {
-	pr_info("Page: %d\n", prv->page_no);
+	struct i2c_eeprom_prv *prv = at24_from_kobj(kobj);
 
-	return strlen(buf);
+	if (!prv)
+		return -ENODEV;
+	return sprintf(buf, "%x\n", prv->page_no);
 }
 
 /**
@@ -174,15 +245,20 @@ static ssize_t at24_get_offset(struct kobject *kobj, struct kobj_attribute *attr
 static ssize_t at24_set_offset(struct kobject *kobj, struct kobj_attribute *attr,
 		const char *buf, size_t count)
 {
-	
-	unsigned int long tmp;
-	if (!kstrtol(buf, 16, &tmp)) {
-		if (tmp < 128) {
+	struct i2c_eeprom_prv *prv = at24_from_kobj(kobj);
+	unsigned long tmp;
+	unsigned int pages;
+
+	if (!prv)
+		return -ENODEV;
+	pages = prv->size / prv->pagesize;
+	if (!kstrtoul(buf, 16, &tmp)) {
+		if (tmp < pages) {
 			prv->page_no = tmp;
 			pr_info("Page: %d\n", prv->page_no);
 		} else {
-			pr_info("128 pages are available\n");
-			pr_info("Choose pages from 0x0 - 0x80\n");
+			pr_info("%d pages are available\n", pages);
+			pr_info("Choose pages from 0x0 - 0x%x\n", pages - 1);
 		}
 	}
 	return count;
@@ -191,18 +267,28 @@ static ssize_t
 at24_flash_erase(struct kobject *kobj, struct kobj_attribute *attr,const char *buf, 
 		size_t count)
 {
-	size_t ret;
+	struct i2c_eeprom_prv *prv = at24_from_kobj(kobj);
+	ssize_t ret;
 	int page_no;
 	char buffer[32];
-	for(page_no=0;page_no<=127; page_no++){
-		loff_t off = page_no * 32;
-		memset(buffer,'\0', 32);
-		ret = at24_eeprom_write(&prv->client_prv, buffer, (int)off, 32);
+
+	if (!prv)
+		return -ENODEV;
+	memset(buffer,'\0', 32);
+	mutex_lock(&prv->lock);
+	/* The journal pages are only ever rewritten through kv/ */
+	for(page_no=0;page_no < prv->size / prv->pagesize; page_no++){
+		loff_t off = page_no * prv->pagesize;
+		if (at24_in_journal(prv, off, prv->pagesize))
+			break;
+		ret = at24_eeprom_write(prv->client, buffer, (int)off, prv->pagesize);
 		if (ret < 0) {
+			mutex_unlock(&prv->lock);
 			pr_info("erase failed\n");
 			return ret;
 		}
 	}
+	mutex_unlock(&prv->lock);
 	return count;
 }
 static struct kobj_attribute at24_rw     = __ATTR(at24c32, 0660, at24_sys_read,at24_sys_write);
@@ -220,48 +306,658 @@ static struct attribute_group attr_group = {
         .attrs = attrs,
 };
 
+/*
+ * Key/value journal
+ *
+ * The top 2 * journal-pages pages of the chip hold two banks of fixed size
+ * records, one record per 32 byte page. Updates are appended to the active
+ * bank as a single page write; the in-RAM index always holds the latest
+ * value of every key so lookups never touch the bus. When the active bank is
+ * full the live keys are copied to the other bank (compaction) and that bank
+ * becomes active.
+ *
+ * A bank is a chain of valid records (magic + crc) with consecutive sequence
+ * numbers starting at slot 0. Records written by compaction carry
+ * AT24_REC_COMPACT except the last one, so a chain ending on a COMPACT record
+ * is an interrupted compaction and is ignored at mount.
+ */
+#define AT24_REC_MAGIC		0xA5
+#define AT24_REC_DATA		22	/* key + value bytes per record */
+#define AT24_REC_DELETE		(1 << 0)	/* tombstone, key only */
+#define AT24_REC_COMPACT	(1 << 1)	/* copied by compaction, not last */
+
+struct at24_rec {
+	u8	magic;
+	u8	flags;
+	u8	klen;
+	u8	vlen;
+	__be32	seq;
+	u8	data[AT24_REC_DATA];	/* key followed by value */
+	__be16	crc;			/* crc16 of all bytes before it */
+} __packed;
+
+struct at24_kv {
+	struct hlist_node hnode;
+	u8	klen;
+	u8	vlen;
+	char	key[AT24_REC_DATA + 1];
+	u8	val[AT24_REC_DATA];
+};
+
+static unsigned int at24_rec_page(struct i2c_eeprom_prv *prv, unsigned int bank,
+				  unsigned int slot)
+{
+	return prv->jbase + bank * prv->jpages + slot;
+}
+
+static bool at24_rec_valid(const struct at24_rec *rec)
+{
+	if (rec->magic != AT24_REC_MAGIC)
+		return false;
+	if (!rec->klen || rec->klen + rec->vlen > AT24_REC_DATA)
+		return false;
+	return crc16(0xffff, (const u8 *)rec, offsetof(struct at24_rec, crc)) ==
+		be16_to_cpu(rec->crc);
+}
+
+static struct at24_kv *at24_kv_find(struct i2c_eeprom_prv *prv,
+				    const char *key, size_t klen)
+{
+	struct at24_kv *kv;
+
+	hash_for_each_possible(prv->kv_index, kv, hnode, jhash(key, klen, 0))
+		if (kv->klen == klen && !memcmp(kv->key, key, klen))
+			return kv;
+	return NULL;
+}
+
+/* Bring the index in line with one record, in journal order */
+static int at24_kv_apply(struct i2c_eeprom_prv *prv, const struct at24_rec *rec)
+{
+	const char *key = (const char *)rec->data;
+	struct at24_kv *kv = at24_kv_find(prv, key, rec->klen);
+
+	if (rec->flags & AT24_REC_DELETE) {
+		if (kv) {
+			hash_del(&kv->hnode);
+			kfree(kv);
+			prv->jlive--;
+		}
+		return 0;
+	}
+	if (!kv) {
+		kv = kzalloc(sizeof(*kv), GFP_KERNEL);
+		if (!kv)
+			return -ENOMEM;
+		kv->klen = rec->klen;
+		memcpy(kv->key, key, rec->klen);
+		hash_add(prv->kv_index, &kv->hnode, jhash(key, rec->klen, 0));
+		prv->jlive++;
+	}
+	kv->vlen = rec->vlen;
+	memcpy(kv->val, rec->data + rec->klen, rec->vlen);
+	return 0;
+}
+
+static void at24_kv_free(struct i2c_eeprom_prv *prv)
+{
+	struct at24_kv *kv;
+	struct hlist_node *tmp;
+	int bkt;
+
+	hash_for_each_safe(prv->kv_index, bkt, tmp, kv, hnode) {
+		hash_del(&kv->hnode);
+		kfree(kv);
+	}
+	prv->jlive = 0;
+}
+
+static int at24_rec_write(struct i2c_eeprom_prv *prv, unsigned int bank,
+			  unsigned int slot, u8 flags, const char *key, u8 klen,
+			  const u8 *val, u8 vlen)
+{
+	struct at24_rec rec;
+	ssize_t ret;
+
+	memset(&rec, 0xff, sizeof(rec));
+	rec.magic = AT24_REC_MAGIC;
+	rec.flags = flags;
+	rec.klen  = klen;
+	rec.vlen  = vlen;
+	rec.seq   = cpu_to_be32(prv->jseq);
+	memcpy(rec.data, key, klen);
+	if (vlen)
+		memcpy(rec.data + klen, val, vlen);
+	rec.crc   = cpu_to_be16(crc16(0xffff, (const u8 *)&rec,
+				      offsetof(struct at24_rec, crc)));
+
+	ret = at24_eeprom_write(prv->client, (const char *)&rec,
+				at24_rec_page(prv, bank, slot) * prv->pagesize,
+				sizeof(rec));
+	if (ret < 0)
+		return ret;
+	prv->jseq++;
+	return 0;
+}
+
+/*
+ * Copy every live key into the other bank, then write the pending record as
+ * the closing (non COMPACT) record. Only then does the new bank win at mount.
+ */
+static int at24_journal_compact(struct i2c_eeprom_prv *prv, u8 flags,
+				const char *key, u8 klen, const u8 *val, u8 vlen)
+{
+	unsigned int bank = !prv->jbank, slot = 0;
+	struct at24_kv *kv;
+	int bkt, ret;
+
+	if (prv->jlive + 1 > prv->jpages)
+		return -ENOSPC;
+	hash_for_each(prv->kv_index, bkt, kv, hnode) {
+		ret = at24_rec_write(prv, bank, slot++, AT24_REC_COMPACT,
+				     kv->key, kv->klen, kv->val, kv->vlen);
+		if (ret)
+			return ret;
+	}
+	ret = at24_rec_write(prv, bank, slot++, flags, key, klen, val, vlen);
+	if (ret)
+		return ret;
+	prv->jbank = bank;
+	prv->jhead = slot;
+	prv->jcompactions++;
+	return 0;
+}
+
+/* Append one set/delete record, compacting first when the bank is full */
+static int at24_journal_append(struct i2c_eeprom_prv *prv, u8 flags,
+			       const char *key, u8 klen, const u8 *val, u8 vlen)
+{
+	struct at24_rec rec;
+	int ret;
+
+	if (!prv->jpages)
+		return -ENODEV;
+	if (!klen || klen + vlen > AT24_REC_DATA)
+		return -EINVAL;
+	if (prv->jhead < prv->jpages) {
+		ret = at24_rec_write(prv, prv->jbank, prv->jhead, flags,
+				     key, klen, val, vlen);
+		if (!ret)
+			prv->jhead++;
+	} else {
+		ret = at24_journal_compact(prv, flags, key, klen, val, vlen);
+	}
+	if (ret)
+		return ret;
+
+	rec.flags = flags;
+	rec.klen  = klen;
+	rec.vlen  = vlen;
+	memcpy(rec.data, key, klen);
+	if (vlen)
+		memcpy(rec.data + klen, val, vlen);
+	return at24_kv_apply(prv, &rec);
+}
+
+/* Scan one bank : length of its valid chain, whether it is committed, max seq */
+static int at24_journal_scan(struct i2c_eeprom_prv *prv, unsigned int bank,
+			     struct at24_rec *recs, unsigned int *len,
+			     bool *valid, u32 *max_seq)
+{
+	unsigned int slot;
+	bool chain = true;
+	ssize_t ret;
+	u32 seq;
+
+	*len = 0;
+	for (slot = 0; slot < prv->jpages; slot++) {
+		ret = at24_eeprom_read(prv->client, (char *)&recs[slot],
+				       at24_rec_page(prv, bank, slot) * prv->pagesize,
+				       sizeof(*recs));
+		if (ret < 0)
+			return ret;
+		if (!at24_rec_valid(&recs[slot])) {
+			chain = false;
+			continue;
+		}
+		seq = be32_to_cpu(recs[slot].seq);
+		if ((s32)(seq - *max_seq) > 0)
+			*max_seq = seq;
+		if (chain && slot &&
+		    seq != be32_to_cpu(recs[slot - 1].seq) + 1)
+			chain = false;
+		if (chain)
+			*len = slot + 1;
+	}
+	*valid = *len && !(recs[*len - 1].flags & AT24_REC_COMPACT);
+	return 0;
+}
+
+static int at24_journal_mount(struct i2c_eeprom_prv *prv)
+{
+	struct at24_rec *recs;
+	unsigned int len[2], slot, bank;
+	bool valid[2];
+	u32 max_seq = 0;
+	int ret;
+
+	recs = kcalloc(2 * prv->jpages, sizeof(*recs), GFP_KERNEL);
+	if (!recs)
+		return -ENOMEM;
+	for (bank = 0; bank < 2; bank++) {
+		ret = at24_journal_scan(prv, bank, recs + bank * prv->jpages,
+					&len[bank], &valid[bank], &max_seq);
+		if (ret)
+			goto out;
+	}
+	/* Both committed : the bank started by the latest compaction wins */
+	if (valid[0] && valid[1])
+		bank = (s32)(be32_to_cpu(recs[prv->jpages].seq) -
+			     be32_to_cpu(recs[0].seq)) > 0;
+	else
+		bank = valid[1];
+
+	prv->jbank = bank;
+	prv->jhead = valid[bank] ? len[bank] : 0;
+	/* Appends must continue the chain; a fresh journal starts past any stale record */
+	if (prv->jhead)
+		prv->jseq = be32_to_cpu(recs[bank * prv->jpages + prv->jhead - 1].seq) + 1;
+	else
+		prv->jseq = max_seq + 1;
+	for (slot = 0; slot < prv->jhead; slot++) {
+		ret = at24_kv_apply(prv, &recs[bank * prv->jpages + slot]);
+		if (ret)
+			goto out;
+	}
+	pr_info("at24 journal: bank %u, %u records, %u keys\n",
+		prv->jbank, prv->jhead, prv->jlive);
+out:
+	kfree(recs);
+	return ret;
+}
+
+/* Copy a sysfs string into a key, dropping the trailing newline */
+static size_t at24_kv_strip(const char *buf, size_t count)
+{
+	if (count && buf[count - 1] == '\n')
+		count--;
+	return count;
+}
+
+static ssize_t at24_kv_key_show(struct kobject *kobj, struct kobj_attribute *attr,
+		char *buf)
+{
+	struct i2c_eeprom_prv *prv = at24_from_kobj(kobj);
+
+	if (!prv)
+		return -ENODEV;
+	return sprintf(buf, "%s\n", prv->kv_key);
+}
+
+static ssize_t at24_kv_key_store(struct kobject *kobj, struct kobj_attribute *attr,
+		const char *buf, size_t count)
+{
+	struct i2c_eeprom_prv *prv = at24_from_kobj(kobj);
+	size_t klen = at24_kv_strip(buf, count);
+
+	if (!prv)
+		return -ENODEV;
+	if (!klen || klen >= AT24_REC_DATA)
+		return -EINVAL;
+	mutex_lock(&prv->lock);
+	memcpy(prv->kv_key, buf, klen);
+	prv->kv_key[klen] = '\0';
+	mutex_unlock(&prv->lock);
+	return count;
+}
+
+static ssize_t at24_kv_value_show(struct kobject *kobj, struct kobj_attribute *attr,
+		char *buf)
+{
+	struct i2c_eeprom_prv *prv = at24_from_kobj(kobj);
+	struct at24_kv *kv;
+	ssize_t ret = -ENOENT;
+
+	if (!prv)
+		return -ENODEV;
+	mutex_lock(&prv->lock);
+	kv = at24_kv_find(prv, prv->kv_key, strlen(prv->kv_key));
+	if (kv) {
+		memcpy(buf, kv->val, kv->vlen);
+		buf[kv->vlen] = '\n';
+		ret = kv->vlen + 1;
+	}
+	mutex_unlock(&prv->lock);
+	return ret;
+}
+
+static ssize_t at24_kv_value_store(struct kobject *kobj, struct kobj_attribute *attr,
+		const char *buf, size_t count)
+{
+	struct i2c_eeprom_prv *prv = at24_from_kobj(kobj);
+	size_t vlen = at24_kv_strip(buf, count);
+	size_t klen;
+	int ret;
+
+	if (!prv)
+		return -ENODEV;
+	mutex_lock(&prv->lock);
+	klen = strlen(prv->kv_key);
+	if (!klen || klen + vlen > AT24_REC_DATA)
+		ret = -EINVAL;
+	else
+		ret = at24_journal_append(prv, 0, prv->kv_key, klen, buf, vlen);
+	mutex_unlock(&prv->lock);
+	return ret ? ret : count;
+}
+
+static ssize_t at24_kv_delete(struct kobject *kobj, struct kobj_attribute *attr,
+		const char *buf, size_t count)
+{
+	struct i2c_eeprom_prv *prv = at24_from_kobj(kobj);
+	size_t klen = at24_kv_strip(buf, count);
+	int ret = 0;
+
+	if (!prv)
+		return -ENODEV;
+	if (!klen || klen >= AT24_REC_DATA)
+		return -EINVAL;
+	mutex_lock(&prv->lock);
+	if (!at24_kv_find(prv, buf, klen))
+		ret = -ENOENT;
+	else
+		ret = at24_journal_append(prv, AT24_REC_DELETE, buf, klen,
+					  NULL, 0);
+	mutex_unlock(&prv->lock);
+	return ret ? ret : count;
+}
+
+static ssize_t at24_kv_keys(struct kobject *kobj, struct kobj_attribute *attr,
+		char *buf)
+{
+	struct i2c_eeprom_prv *prv = at24_from_kobj(kobj);
+	struct at24_kv *kv;
+	ssize_t len = 0;
+	int bkt;
+
+	if (!prv)
+		return -ENODEV;
+	mutex_lock(&prv->lock);
+	hash_for_each(prv->kv_index, bkt, kv, hnode)
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%s\n", kv->key);
+	mutex_unlock(&prv->lock);
+	return len;
+}
+
+static ssize_t at24_kv_stats(struct kobject *kobj, struct kobj_attribute *attr,
+		char *buf)
+{
+	struct i2c_eeprom_prv *prv = at24_from_kobj(kobj);
+
+	if (!prv)
+		return -ENODEV;
+	return sprintf(buf, "bank %u used %u/%u keys %u seq %u compactions %u\n",
+		       prv->jbank, prv->jhead, prv->jpages, prv->jlive,
+		       prv->jseq, prv->jcompactions);
+}
+
+static struct kobj_attribute at24_kv_key_attr   = __ATTR(key, 0660, at24_kv_key_show, at24_kv_key_store);
+static struct kobj_attribute at24_kv_value_attr = __ATTR(value, 0660, at24_kv_value_show, at24_kv_value_store);
+static struct kobj_attribute at24_kv_del_attr   = __ATTR(delete, 0220, NULL, at24_kv_delete);
+static struct kobj_attribute at24_kv_keys_attr  = __ATTR(keys, 0444, at24_kv_keys, NULL);
+static struct kobj_attribute at24_kv_stats_attr = __ATTR(stats, 0444, at24_kv_stats, NULL);
+
+static struct attribute *kv_attrs[] = {
+        &at24_kv_key_attr.attr,
+        &at24_kv_value_attr.attr,
+        &at24_kv_del_attr.attr,
+        &at24_kv_keys_attr.attr,
+        &at24_kv_stats_attr.attr,
+        NULL,
+};
+
+/* /sys/at24c32_eeprom-<bus>-<addr>/kv/ */
+static struct attribute_group kv_attr_group = {
+        .name  = "kv",
+        .attrs = kv_attrs,
+};
+
+/*
+ * Aggregation layer : map a linear offset onto (chip, chip offset). Caller
+ * holds at24_chips_lock so the list can not change under the transfer.
+ */
+static struct i2c_eeprom_prv *at24_array_lookup(loff_t *off)
+{
+	struct i2c_eeprom_prv *prv;
+
+	list_for_each_entry(prv, &at24_chips, node) {
+		if (*off < prv->size)
+			return prv;
+		*off -= prv->size;
+	}
+	return NULL;
+}
+
+static ssize_t at24_array_read(struct file *filp, struct kobject *kobj,
+		struct bin_attribute *attr, char *buf, loff_t off, size_t count)
+{
+	struct i2c_eeprom_prv *prv;
+	loff_t chip_off;
+	size_t done = 0, chunk;
+	ssize_t ret = 0;
+
+	mutex_lock(&at24_chips_lock);
+	while (done < count) {
+		chip_off = off + done;
+		prv = at24_array_lookup(&chip_off);
+		if (!prv)
+			break;
+		/* A read never crosses into the next chip, split it there */
+		chunk = min_t(size_t, count - done, prv->size - chip_off);
+		chunk = min_t(size_t, chunk, read_limit);
+		mutex_lock(&prv->lock);
+		ret = at24_eeprom_read(prv->client, buf + done, chip_off, chunk);
+		mutex_unlock(&prv->lock);
+		if (ret < 0)
+			break;
+		done += ret;
+	}
+	mutex_unlock(&at24_chips_lock);
+
+	return done ? done : ret;
+}
+
+static ssize_t at24_array_write(struct file *filp, struct kobject *kobj,
+		struct bin_attribute *attr, char *buf, loff_t off, size_t count)
+{
+	struct i2c_eeprom_prv *prv;
+	loff_t chip_off;
+	size_t done = 0, chunk;
+	ssize_t ret = 0;
+
+	mutex_lock(&at24_chips_lock);
+	while (done < count) {
+		chip_off = off + done;
+		prv = at24_array_lookup(&chip_off);
+		if (!prv)
+			break;
+		/* Page writes wrap inside the page, so stop at every page boundary */
+		chunk = min_t(size_t, count - done,
+			      prv->pagesize - (chip_off % prv->pagesize));
+		chunk = min_t(size_t, chunk, write_max);
+		if (at24_in_journal(prv, chip_off, chunk)) {
+			ret = -EBUSY;
+			break;
+		}
+		mutex_lock(&prv->lock);
+		ret = at24_eeprom_write(prv->client, buf + done, chip_off, chunk);
+		mutex_unlock(&prv->lock);
+		if (ret < 0)
+			break;
+		done += ret;
+	}
+	mutex_unlock(&at24_chips_lock);
+
+	return done ? done : ret;
+}
+
+static struct bin_attribute at24_array_bin = {
+	.attr = {
+		.name = "eeprom",
+		.mode = 0660,
+	},
+	.read  = at24_array_read,
+	.write = at24_array_write,
+};
+
+/*
+ * Resize /sys/at24c32_array/eeprom after a chip came or went. Must not be
+ * called with at24_chips_lock held : removing the bin file waits for readers
+ * that may be blocked on that lock.
+ */
+static void at24_array_update(void)
+{
+	struct i2c_eeprom_prv *prv;
+	size_t total = 0;
+	int nchips = 0;
+
+	if (!aggregate)
+		return;
+	mutex_lock(&at24_array_lock);
+	if (at24_array_bin_added) {
+		sysfs_remove_bin_file(at24_array_kobj, &at24_array_bin);
+		at24_array_bin_added = false;
+	}
+	mutex_lock(&at24_chips_lock);
+	list_for_each_entry(prv, &at24_chips, node) {
+		total += prv->size;
+		nchips++;
+	}
+	mutex_unlock(&at24_chips_lock);
+	if (!nchips) {
+		kobject_put(at24_array_kobj);
+		at24_array_kobj = NULL;
+		goto out;
+	}
+	if (!at24_array_kobj) {
+		at24_array_kobj = kobject_create_and_add("at24c32_array", NULL);
+		if (!at24_array_kobj)
+			goto out;
+	}
+	at24_array_bin.size = total;
+	if (!sysfs_create_bin_file(at24_array_kobj, &at24_array_bin))
+		at24_array_bin_added = true;
+	pr_info("at24c32_array: %d chip(s), %zu bytes\n", nchips, total);
+out:
+	mutex_unlock(&at24_array_lock);
+}
+
+/* Keep the list ordered by adapter then address so the linear layout is stable */
+static void at24_chips_insert(struct i2c_eeprom_prv *new)
+{
+	struct i2c_eeprom_prv *prv;
+
+	list_for_each_entry(prv, &at24_chips, node) {
+		if (prv->client->adapter->nr > new->client->adapter->nr ||
+		    (prv->client->adapter->nr == new->client->adapter->nr &&
+		     prv->client->addr > new->client->addr))
+			break;
+	}
+	list_add_tail(&new->node, &prv->node);
+}
+
 static int i2c_eeprom_probe(struct i2c_client *client, const struct i2c_device_id *id)
 {
+	struct i2c_eeprom_prv *prv;
+	char name[32];
 	int ret;
-	pr_info("%s: Device at24c32 probed......\n",__func__);	
+	pr_info("%s: Device at24c32 probed at 0x%02x......\n",__func__, client->addr);
 	prv=(struct i2c_eeprom_prv *)kzalloc(sizeof(struct i2c_eeprom_prv), GFP_KERNEL);		
 	if(!prv){
 		pr_info("Requested memory not allocated\n");
 		return -ENOMEM;
 	}
-	prv->client_prv = *client;
+	prv->client = client;
+	mutex_init(&prv->lock);
 	ret=device_property_read_u32(&client->dev, "size", &prv->size);
 	if(ret){
 		dev_err(&client->dev, "Error: missing \"size\" property\n");
-		return -ENODEV;
+		ret = -ENODEV;
+		goto err_free;
 	}
 	ret=device_property_read_u32(&client->dev, "pagesize", &prv->pagesize);
-	if(ret){
+	if(ret || !prv->pagesize || prv->pagesize > write_max){
 		dev_err(&client->dev, "Error: missing \"pagesize\" property\n");
-		return -ENODEV;
+		ret = -ENODEV;
+		goto err_free;
 	}
 	ret=device_property_read_u32(&client->dev, "address-width", &prv->address_width);
 	if(ret){
 		 dev_err(&client->dev, "Error: missing \"address-width\" property\n");
-		return -ENODEV;
+		ret = -ENODEV;
+		goto err_free;
+	}
+	/* One directory per chip : /sys/at24c32_eeprom-<bus>-<addr> */
+	snprintf(name, sizeof(name), "at24c32_eeprom-%d-%02x",
+		 client->adapter->nr, client->addr);
+	prv->at24_kobj=kobject_create_and_add(name, NULL);
+	if(!prv->at24_kobj){
+		ret = -ENOMEM;
+		goto err_free;
 	}
-	prv->at24_kobj=kobject_create_and_add("at24c32_eeprom", NULL);
-	if(!prv->at24_kobj)
-		return -ENOMEM;
 	ret= sysfs_create_group(prv->at24_kobj, &attr_group);
-	if(ret)
+	if(ret){
 		kobject_put(prv->at24_kobj);
+		goto err_free;
+	}
+	/* Optional key/value journal in the top 2 * journal-pages pages */
+	hash_init(prv->kv_index);
+	if (!device_property_read_u32(&client->dev, "journal-pages", &prv->jpages) &&
+	    prv->jpages) {
+		if (prv->pagesize != sizeof(struct at24_rec) ||
+		    2 * prv->jpages > prv->size / prv->pagesize) {
+			dev_err(&client->dev, "Error: bad \"journal-pages\" property\n");
+			ret = -EINVAL;
+			goto err_kobj;
+		}
+		prv->jbase = prv->size / prv->pagesize - 2 * prv->jpages;
+		ret = at24_journal_mount(prv);
+		if (!ret)
+			ret = sysfs_create_group(prv->at24_kobj, &kv_attr_group);
+		if (ret)
+			goto err_kobj;
+	}
+	i2c_set_clientdata(client, prv);
+
+	mutex_lock(&at24_chips_lock);
+	at24_chips_insert(prv);
+	mutex_unlock(&at24_chips_lock);
+	at24_array_update();
+
 	pr_info("       SIZE            :%d\n", prv->size);
 	pr_info("       PAGESIZE        :%d\n", prv->pagesize);
 	pr_info("       address-width   :%d\n", prv->address_width);
 	return 0;	
+err_kobj:
+	at24_kv_free(prv);
+	kobject_put(prv->at24_kobj);
+err_free:
+	kfree(prv);
+	return ret;
 }
 
 static int i2c_eeprom_remove(struct i2c_client *client)
 {
+	struct i2c_eeprom_prv *prv = i2c_get_clientdata(client);
+
 	pr_info("at24_remove\n");
-	kfree(prv); 
+	mutex_lock(&at24_chips_lock);
+	list_del(&prv->node);
+	mutex_unlock(&at24_chips_lock);
+	at24_array_update();
 	kobject_put(prv->at24_kobj);
+	at24_kv_free(prv);
+	kfree(prv); 
 	return 0;
 }
 
@@ -1,236 +1,272 @@
 #include <linux/module.h>
 #include <linux/init.h>
-#include <linux/slab.h>
 #include <linux/kernel.h>
+#include <linux/slab.h>
 #include <linux/spi/spi.h>
-#include <linux/sysfs.h>
-#include <linux/kobject.h>
-#include <linux/jiffies.h>
-#include <linux/delay.h>
+#include <linux/regmap.h>
+#include <linux/interrupt.h>
+#include <linux/atomic.h>
+#include <linux/wait.h>
+#include <asm/unaligned.h>
 
+#include "adxl345.h"
 
-struct adxl345_prv {
-	struct 	spi_device *spi;
-	struct kobject *adxl345_kobj;
-};
-
-struct adxl345_prv *prv=NULL;
-
+/*
+ * spi_async acquisition
+ *
+ * While the FIFO stream is open every INT1 edge is served without a
+ * thread: the hard IRQ handler masks the line, stamps the batch and
+ * submits the status message of one of two buffers (INT_SOURCE and
+ * FIFO_STATUS). Its completion sizes the entry message to FIFO_STATUS and
+ * submits it (a 6 byte burst per entry, CS released between entries so the
+ * FIFO pops). Every read pops an entry, so bursting a fixed count would
+ * discard samples that land during the burst whenever INT1 fires below
+ * the watermark. The entry completion unmasks INT1 first, so the next
+ * batch can already go out on the other buffer while this one is decoded
+ * and handed to adxl345_core_push(). Messages complete in order, so a
+ * buffer is never refilled before its previous contents were consumed.
+ */
+#define ADXL345_ENTRY_LEN	7	/* command byte + DATAX0..DATAZ1 */
 
-/* The adxl345 Config registers */
-enum ADXL345_Reg {
-	BW_RATE		= 0x2C, 	// Bandwidth rate register(0x2C) : Data rate and power mode control.
-	POWER_CTL	= 0x2D,		// Power-saving features control.Power control register
-	DATA_FORMAT	= 0x31, 	// Select Data format register(0x31): Data format control.
-	DEVID		= 0x00,		// Device ID.
+struct adxl345_spi_buf {
+	struct spi_message status_msg;	/* INT_SOURCE, FIFO_STATUS */
+	struct spi_message msg;		/* n FIFO entries */
+	struct spi_transfer *xfer;
+	unsigned int n;
+	u8 *rx;				/* DMA safe : kmalloc'ed */
+	s64 timestamp;
+	s16 xyz[ADXL345_FIFO_MAX][3];
+	struct adxl345_spi *ctx;
 };
 
-enum Axis_reg {
-	DATAX0		= 0x32,
-	DATAX1		= 0x33,
-	DATAY0		= 0x34,
-	DATAY1		= 0x35,
-	DATAZ0		= 0x36,
-	DATAZ1		= 0x37,
+struct adxl345_spi {
+	struct spi_device *spi;
+	struct adxl345_fastpath fast;
+	u8 *tx;				/* commands, shared by both messages */
+	struct adxl345_spi_buf buf[2];
+	unsigned int cur;
+	atomic_t inflight;
+	wait_queue_head_t idle;
+	unsigned long errors;
 };
 
-static unsigned adxl345_timeout = 25; /*default timeout for normal I2c  devices */
-/* register access */
+/* rx layout : [0..1] INT_SOURCE, [2..3] FIFO_STATUS, then the entries */
+#define RX_SRC		1
+#define RX_STATUS	3
+#define RX_ENTRY(i)	(4 + (i) * ADXL345_ENTRY_LEN + 1)
 
-/* All registers are word-sized, except for the configuration register.
-   LM75 uses a high-byte first convention, which is exactly opposite to
-   the SMBus standard. */
-static int adxl345_read_value(struct spi_device *spi, u8 reg)
+/* Any context; the count is otherwise invisible, so say it */
+static void adxl345_spi_error(struct adxl345_spi *ctx, int err)
 {
-	reg= 0x80 | reg;
-	return spi_w8r8(spi,reg);
+	ctx->errors++;
+	dev_warn_ratelimited(&ctx->spi->dev, "spi_async batch failed %d (%lu)\n",
+			     err, ctx->errors);
 }
 
-static int adxl345_write_value(struct spi_device *spi, u8 reg,u8 value)
+static void adxl345_spi_done(struct adxl345_spi *ctx)
 {
-	unsigned char buf[2];
- 
-	buf[0] = reg & 0x7f;
-	buf[1] = value;
- 
-	return spi_write_then_read(spi, buf, 2, NULL, 0);
+	if (atomic_dec_and_test(&ctx->inflight))
+		wake_up(&ctx->idle);
 }
 
-static ssize_t 
-x_read(struct kobject *kobj, struct kobj_attribute *attr,char *buf)
+static void adxl345_spi_complete(void *context)
 {
-	char data[2] ={0};
-	int  xAccl;
-	unsigned long timeout, read_time;
-
-	timeout = jiffies + msecs_to_jiffies(adxl345_timeout);
-	do{
-		read_time = jiffies;
-		data[0] = adxl345_read_value(prv->spi,DATAX0); 
-		data[1] = adxl345_read_value(prv->spi,DATAX1);
-		if (data[0] < 0 || data[1] < 0 )
-			pr_err("LSB %d, MSB %d, LSB err %d,MSB err %d\n",
-						DATAX0,DATAX0, data[0],data[1]);
-		else{
-			xAccl = ((data[1] & 0x03) * 256 + (data[0] & 0xFF));
-			if(xAccl > 511){
-			 	xAccl -= 1024;
-			}
-			return sprintf(buf, "Acceleration in X-Axis : %d\n",xAccl);
-		}
-		msleep(1);
+	struct adxl345_spi_buf *b = context;
+	struct adxl345_spi *ctx = b->ctx;
+	unsigned int i, j;
+
+	/* The FIFO was read down below the watermark : let the next edge in */
+	enable_irq(ctx->spi->irq);
 
-	}while (time_before(read_time, timeout));
-	
-	return -ETIMEDOUT;
+	if (b->msg.status) {
+		adxl345_spi_error(ctx, b->msg.status);
+	} else {
+		for (i = 0; i < b->n; i++)
+			for (j = 0; j < 3; j++)
+				b->xyz[i][j] = (s16)get_unaligned_le16(
+						&b->rx[RX_ENTRY(i) + 2 * j]);
+		adxl345_core_push(&ctx->spi->dev, b->rx[RX_SRC], b->xyz, b->n,
+				  b->timestamp);
+	}
+	adxl345_spi_done(ctx);
 }
-static ssize_t 
-y_read(struct kobject *kobj, struct kobj_attribute *attr,char *buf)
+
+/* Read exactly the FIFO_STATUS entries, later arrivals stay queued */
+static void adxl345_spi_status_complete(void *context)
 {
-	char data[2] ={0};
-	int  yAccl;
-	unsigned long timeout, read_time;
-
-	timeout = jiffies + msecs_to_jiffies(adxl345_timeout);
-	do{
-		read_time = jiffies;
-		data[0] = adxl345_read_value(prv->spi,DATAY0); 
-		data[1] = adxl345_read_value(prv->spi,DATAY1);
-		if (data[0] < 0 || data[1] < 0 )
-			pr_err("LSB %d, MSB %d, LSB err %d,MSB err %d\n",
-						DATAX0,DATAX0, data[0],data[1]);
-		else{
-			yAccl = ((data[1] & 0x03) * 256 + (data[0] & 0xFF));
-			if(yAccl > 511){
-				 yAccl -= 1024;
-			}
-			return sprintf(buf, "Acceleration in Y-Axis : %d\n",yAccl);
-		}
-		
-		msleep(1);
-	}while (time_before(read_time, timeout));
-	
-	return -ETIMEDOUT;
+	struct adxl345_spi_buf *b = context;
+	struct adxl345_spi *ctx = b->ctx;
+	struct spi_transfer *t = &b->xfer[2];
+	unsigned int i;
+	int ret;
+
+	if (b->status_msg.status) {
+		adxl345_spi_error(ctx, b->status_msg.status);
+		goto out;
+	}
+	b->n = min_t(unsigned int, b->rx[RX_STATUS] & 0x3F, ADXL345_FIFO_MAX);
+	if (!b->n) {
+		/* Motion or overrun only : nothing to read */
+		adxl345_core_push(&ctx->spi->dev, b->rx[RX_SRC], b->xyz, 0,
+				  b->timestamp);
+		goto out;
+	}
+	spi_message_init(&b->msg);
+	b->msg.complete = adxl345_spi_complete;
+	b->msg.context = b;
+	for (i = 0; i < b->n; i++) {
+		/* CS high >= 5 us between FIFO reads, datasheet */
+		t[i].cs_change = i + 1 < b->n;
+		spi_message_add_tail(&t[i], &b->msg);
+	}
+	ret = spi_async(ctx->spi, &b->msg);
+	if (!ret)
+		return;
+	adxl345_spi_error(ctx, ret);
+out:
+	/* INT1 is level : if entries are left the next edge comes at once */
+	enable_irq(ctx->spi->irq);
+	adxl345_spi_done(ctx);
 }
-static ssize_t 
-z_read(struct kobject *kobj, struct kobj_attribute *attr,char *buf)
+
+static irqreturn_t adxl345_spi_irq(void *priv, s64 timestamp)
 {
-	char data[2] ={0};
-	int  zAccl;
-	unsigned long timeout, read_time;
-
-	timeout = jiffies + msecs_to_jiffies(adxl345_timeout);
-	do{
-		read_time = jiffies;
-		data[0] = adxl345_read_value(prv->spi,DATAZ0); 
-		data[1] = adxl345_read_value(prv->spi,DATAZ1);
-		if (data[0] < 0 || data[1] < 0 )
-			pr_err("LSB %d, MSB %d, LSB err %d,MSB err %d\n",
-						DATAX0,DATAX0, data[0],data[1]);
-		else{
-			zAccl = ((data[1] & 0x03) * 256 + (data[0] & 0xFF));
-			if(zAccl > 511){
-				 zAccl -= 1024;
-			}
-			return sprintf(buf, "Acceleration in Z-Axis : %d\n",zAccl);
-		}
-		msleep(1);
-	}while (time_before(read_time, timeout));
-	
-	return -ETIMEDOUT;
+	struct adxl345_spi *ctx = priv;
+	struct adxl345_spi_buf *b = &ctx->buf[ctx->cur];
+	int ret;
+
+	/* Level triggered : keep it masked until the FIFO has been read */
+	disable_irq_nosync(ctx->spi->irq);
+	b->timestamp = timestamp;
+	atomic_inc(&ctx->inflight);
+	ret = spi_async(ctx->spi, &b->status_msg);
+	if (ret) {
+		/*
+		 * Let the core's thread drain it through the regmap instead;
+		 * adxl345_core_push() serializes it with a batch still completing
+		 */
+		atomic_dec(&ctx->inflight);
+		adxl345_spi_error(ctx, ret);
+		enable_irq(ctx->spi->irq);
+		return IRQ_WAKE_THREAD;
+	}
+	ctx->cur ^= 1;
+	return IRQ_HANDLED;
 }
-static struct kobj_attribute xaxis_read  = __ATTR(Xaxis, 0444, x_read,NULL);
-static struct kobj_attribute yaxis_read  = __ATTR(Yaxis, 0444, y_read,NULL);
-static struct kobj_attribute zaxis_read  = __ATTR(Zaxis, 0444, z_read,NULL);
-
-static struct attribute *attrs[] = {
-        &xaxis_read.attr,
-        &yaxis_read.attr,
-        &zaxis_read.attr,
-        NULL,
-};
 
-static struct attribute_group attr_group = {
-        .attrs = attrs,
-};
-//1.BW_RATE	: Set MODE		= 0x0A,   :00001010     //Normal mode, Output data rate = 100 Hz(0x0A)
-//2.POWER_CTL	: Set AUTO_SLEEP	= 0x08,   :00001000	//Auto-sleep disable
-//3.DATA_FORMAT: Set SELF_TEST		= 0x08,	  :00001000	//Self test disabled, 4-wire interface, Full resolution, range = +/-2g(0x08)
+static void adxl345_spi_free(struct adxl345_spi *ctx)
+{
+	int i;
 
-static int adxl345_probe(struct spi_device *spi)
+	for (i = 0; i < 2; i++) {
+		kfree(ctx->buf[i].xfer);
+		kfree(ctx->buf[i].rx);
+		ctx->buf[i].xfer = NULL;
+		ctx->buf[i].rx = NULL;
+	}
+	kfree(ctx->tx);
+	ctx->tx = NULL;
+}
+
+static void adxl345_spi_stop(void *priv)
+{
+	struct adxl345_spi *ctx = priv;
+
+	wait_event(ctx->idle, !atomic_read(&ctx->inflight));
+	adxl345_spi_free(ctx);
+}
+
+/*
+ * Build both buffers for up to a full FIFO; sleeps, runs at stream open.
+ * The entry message is assembled per batch, @watermark only sets when
+ * INT1 fires.
+ */
+static int adxl345_spi_start(void *priv, unsigned int watermark)
 {
-	int ret,new;
-	u8 set_mask,devid;
-	int status;
-	pr_info("%s: Device adxl345 probed......\n",__func__);	
-	prv=(struct adxl345_prv *)kzalloc(sizeof(struct adxl345_prv), GFP_KERNEL);		
-	if(!prv){
-		pr_info("Requested memory not allocated\n");
+	struct adxl345_spi *ctx = priv;
+	size_t rx_len = RX_ENTRY(ADXL345_FIFO_MAX) - 1;
+	struct spi_transfer *t;
+	unsigned int i, k;
+
+	ctx->cur = 0;
+	ctx->tx = kzalloc(4 + ADXL345_ENTRY_LEN, GFP_KERNEL);
+	if (!ctx->tx)
 		return -ENOMEM;
+	ctx->tx[0] = ADXL345_SPI_READ | INT_SOURCE;
+	ctx->tx[2] = ADXL345_SPI_READ | FIFO_STATUS;
+	ctx->tx[4] = ADXL345_SPI_READ | ADXL345_SPI_MB | DATAX0;
+
+	for (k = 0; k < 2; k++) {
+		struct adxl345_spi_buf *b = &ctx->buf[k];
+
+		b->ctx = ctx;
+		b->rx = kzalloc(rx_len, GFP_KERNEL);
+		b->xfer = kcalloc(ADXL345_FIFO_MAX + 2, sizeof(*b->xfer),
+				  GFP_KERNEL);
+		if (!b->rx || !b->xfer) {
+			adxl345_spi_free(ctx);
+			return -ENOMEM;
+		}
+		spi_message_init(&b->status_msg);
+		b->status_msg.complete = adxl345_spi_status_complete;
+		b->status_msg.context = b;
+
+		t = b->xfer;
+		t[0].tx_buf = &ctx->tx[0];
+		t[0].rx_buf = &b->rx[0];
+		t[0].len = 2;
+		t[0].cs_change = 1;
+		t[1].tx_buf = &ctx->tx[2];
+		t[1].rx_buf = &b->rx[2];
+		t[1].len = 2;
+		spi_message_add_tail(&t[0], &b->status_msg);
+		spi_message_add_tail(&t[1], &b->status_msg);
+		for (i = 0; i < ADXL345_FIFO_MAX; i++) {
+			t[2 + i].tx_buf = &ctx->tx[4];
+			t[2 + i].rx_buf = &b->rx[RX_ENTRY(i) - 1];
+			t[2 + i].len = ADXL345_ENTRY_LEN;
+			t[2 + i].delay_usecs = 5;
+		}
 	}
-	prv->spi=spi;
+	return 0;
+}
+
+static int adxl345_probe(struct spi_device *spi)
+{
+	struct regmap_config config = adxl345_regmap_config;
+	struct regmap *regmap;
+	struct adxl345_spi *ctx;
+
 	pr_info("SPI CLK %d Hz \n", spi->max_speed_hz);
 	pr_info("bits_per_word:  %d \n", spi->bits_per_word);
 	pr_info("MODE %d Hz \n", spi->mode);
 
-	devid = adxl345_read_value(spi, DEVID); 
-	/* The Device ID of the ADXL345 is 0xE5, which is 229 in decimal, This should be print. */
-	pr_info("DEVID: Device id is %02x\n",devid);
-	/* device driver data */
-	spi_set_drvdata(spi, prv);
-	set_mask = (1 << 1) | (1 << 3);
-	/* configure as specified */
-	status = adxl345_read_value(spi, BW_RATE);
-	if (status < 0) 
-		dev_dbg(&spi->dev, "Can't read BW_RATE config? %d\n", status);
-	
-	new = status | set_mask ;
-	adxl345_write_value(spi, BW_RATE , new);
-	dev_dbg(&spi->dev, "BW_RATE Config %02x\n", new);
-	
-	/*Reset*/
-	set_mask = 0;
-	new = 0;
-	set_mask = (1 << 3);
-	/* configure as specified */
-	status = adxl345_read_value(spi,POWER_CTL);
-	if (status < 0) 
-		dev_dbg(&spi->dev, "Can't read POWER_CTL config? %d\n", status);
-	
-	new = status | set_mask ;
-	adxl345_write_value(spi, POWER_CTL , new);
-	dev_dbg(&spi->dev, "POWER_CTL Config %02x\n", new);
-	
-	/*Reset*/
-	set_mask=0;
-	new=0;
-	set_mask = (1 << 3);  //Selecting 4 wire config
-	/* configure as specified */
-	status = adxl345_read_value(spi,DATA_FORMAT);
-	if (status < 0) 
-		dev_dbg(&spi->dev, "Can't read DATA_FORMAT config? %d\n", status);
-	
-	new = status | set_mask ;
-	adxl345_write_value(spi, DATA_FORMAT, new);
-	dev_dbg(&spi->dev, "DATA_FORMAT Config %02x\n", new);
-	
-	
-	
-	prv->adxl345_kobj=kobject_create_and_add("adxl345", NULL);
-	if(!prv->adxl345_kobj)
+	/* regmap copies what it needs, the config may live on the stack */
+	config.read_flag_mask = ADXL345_SPI_READ | ADXL345_SPI_MB;
+	regmap = devm_regmap_init_spi(spi, &config);
+	if (IS_ERR(regmap)) {
+		dev_err(&spi->dev, "regmap init failed %ld\n", PTR_ERR(regmap));
+		return PTR_ERR(regmap);
+	}
+
+	ctx = devm_kzalloc(&spi->dev, sizeof(*ctx), GFP_KERNEL);
+	if (!ctx)
 		return -ENOMEM;
-	ret= sysfs_create_group(prv->adxl345_kobj, &attr_group);
-	if(ret)
-		kobject_put(prv->adxl345_kobj);
-	
-	return 0;
+	ctx->spi = spi;
+	atomic_set(&ctx->inflight, 0);
+	init_waitqueue_head(&ctx->idle);
+	ctx->fast.start = adxl345_spi_start;
+	ctx->fast.stop = adxl345_spi_stop;
+	ctx->fast.irq = adxl345_spi_irq;
+	ctx->fast.priv = ctx;
+
+	return adxl345_core_probe(&spi->dev, regmap, spi->irq, "adxl345",
+				  spi->irq > 0 ? &ctx->fast : NULL);
 }
 static int adxl345_remove(struct spi_device *spi)
 {
 	pr_info("adxl345_remove\n");
-	kfree(prv);
-	kobject_put(prv->adxl345_kobj);
-	return 0;
+	return adxl345_core_remove(&spi->dev);
 }
 static const struct of_device_id  adxl345_of_match[]={
 	{.compatible = "ADLX,adxl345", },
@@ -258,7 +294,7 @@ static struct spi_driver adxl345_drv = {
 module_spi_driver(adxl345_drv);
 
 
-MODULE_DESCRIPTION("Driver for ADXL345 Digital Accelerometer");
+MODULE_DESCRIPTION("Driver for ADXL345 Digital Accelerometer, SPI bus");
 MODULE_AUTHOR("Chandan jha <beingchandanjha@gmail.com>");
 MODULE_LICENSE("GPL");
 MODULE_VERSION(".1");